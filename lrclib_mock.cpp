@@ -0,0 +1,230 @@
+/*
+ * Copyright 12/07/2025 https://github.com/su8/0verau
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+// Local stand-in for lrclib.net: answers /api/get with canned lyrics after a configurable
+// delay, and with 404s and 503s at configurable rates, so the lyrics path can be tested offline.
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+struct Options {
+  int port = 8080;
+  int latencyMs = 50;    // added to every answer
+  int jitterMs = 0;      // up to this much more, uniformly
+  double errorRate = 0;  // share of requests answered with 503
+  double missingRate = 0; // share of songs lrclib "doesn't know", the same songs every time
+  int lines = 60;        // lyric lines per song
+};
+
+Options options;
+std::atomic<bool> running(true);
+std::atomic<uint64_t> served(0), notFound(0), failed(0);
+
+// Stable hash of the query, picks the lyrics and whether the song is missing
+static uint64_t fnv1a(const std::string &text) {
+  uint64_t hash = 1469598103934665603ULL;
+  for (unsigned char c : text) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Value of one query parameter, %XX and + decoded
+static std::string queryParam(const std::string &target, const std::string &name) {
+  size_t pos = target.find('?');
+  while (pos != std::string::npos) {
+    pos++;
+    size_t end = target.find('&', pos);
+    std::string pair = target.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+    if (pair.compare(0, name.size() + 1, name + "=") == 0) {
+      std::string value;
+      for (size_t i = name.size() + 1; i < pair.size(); i++) {
+        if (pair[i] == '%' && i + 2 < pair.size()) {
+          value += static_cast<char>(std::strtol(pair.substr(i + 1, 2).c_str(), nullptr, 16));
+          i += 2;
+        }
+        else {
+          value += (pair[i] == '+') ? ' ' : pair[i];
+        }
+      }
+      return value;
+    }
+    pos = end;
+  }
+  return "";
+}
+
+// Canned lrclib answer for a song
+static std::string lyricsBody(const std::string &artist, const std::string &title, uint64_t hash) {
+  std::string synced, plain;
+  char stamp[16];
+  for (int i = 0; i < options.lines; i++) {
+    double t = 5.0 + i * 3.2;
+    int minutes = static_cast<int>(t / 60.0);
+    snprintf(stamp, sizeof(stamp), "[%02d:%05.2f]", minutes, t - minutes * 60.0);
+    std::string line = "Line " + std::to_string(i + 1) + " of " + title + " (" + std::to_string(hash % 1000) + ")";
+    synced += stamp + line + "\n";
+    plain += line + "\n";
+  }
+  json body = {{"id", hash % 1000000}, {"trackName", title}, {"artistName", artist}, {"albumName", "Mock Album"}, {"duration", 5.0 + options.lines * 3.2}, {"instrumental", false}, {"plainLyrics", plain}, {"syncedLyrics", synced}};
+  return body.dump();
+}
+
+static bool sendAll(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// One keep-alive connection, requests are answered in order
+static void serveConnection(int fd) {
+  std::mt19937 rng(std::random_device{}());
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  std::string buffer;
+  char chunk[4096];
+  while (running) {
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        close(fd);
+        return;
+      }
+      buffer.append(chunk, static_cast<size_t>(n));
+    }
+    std::string head = buffer.substr(0, headerEnd);
+    buffer.erase(0, headerEnd + 4);
+    size_t space = head.find(' ');
+    std::string target = head.substr(space + 1, head.find(' ', space + 1) - space - 1);
+    std::string lower = head;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    bool keepAlive = lower.find("connection: close") == std::string::npos;
+
+    int delay = options.latencyMs + ((options.jitterMs > 0) ? static_cast<int>(rng() % static_cast<unsigned int>(options.jitterMs + 1)) : 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    std::string artist = queryParam(target, "artist_name");
+    std::string title = queryParam(target, "track_name");
+    uint64_t hash = fnv1a(artist + '\n' + title);
+    int code = 200;
+    std::string body;
+    if (target.rfind("/api/get", 0) != 0) {
+      code = 404;
+      body = R"({"code":404,"name":"NotFound","message":"No such endpoint"})";
+    }
+    else if (chance(rng) < options.errorRate) {
+      code = 503;
+      body = R"({"code":503,"name":"ServiceUnavailable","message":"Mock error"})";
+    }
+    else if (static_cast<double>(hash % 10000) / 10000.0 < options.missingRate) {
+      code = 404;
+      body = R"({"code":404,"name":"TrackNotFound","message":"Failed to find specified track"})";
+    }
+    else {
+      body = lyricsBody(artist, title, hash);
+    }
+    (code == 200 ? served : code == 404 ? notFound : failed)++;
+    std::string status = (code == 200) ? "200 OK" : (code == 404) ? "404 Not Found" : "503 Service Unavailable";
+    std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: " + (keepAlive ? "keep-alive" : "close") + "\r\n\r\n" + body;
+    if (!sendAll(fd, response) || !keepAlive) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+void signal_handler(int) {
+  running = false;
+}
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--port=", 0) == 0) {
+      options.port = std::atoi(arg.c_str() + 7);
+    }
+    else if (arg.rfind("--latency=", 0) == 0) {
+      options.latencyMs = std::max(0, std::atoi(arg.c_str() + 10));
+    }
+    else if (arg.rfind("--jitter=", 0) == 0) {
+      options.jitterMs = std::max(0, std::atoi(arg.c_str() + 9));
+    }
+    else if (arg.rfind("--errors=", 0) == 0) {
+      options.errorRate = std::clamp(std::atof(arg.c_str() + 9), 0.0, 1.0);
+    }
+    else if (arg.rfind("--missing=", 0) == 0) {
+      options.missingRate = std::clamp(std::atof(arg.c_str() + 10), 0.0, 1.0);
+    }
+    else if (arg.rfind("--lines=", 0) == 0) {
+      options.lines = std::clamp(std::atoi(arg.c_str() + 8), 0, 10000);
+    }
+    else {
+      std::cerr << argv[0] << " [--port=8080] [--latency=ms] [--jitter=ms] [--errors=0.0-1.0] [--missing=0.0-1.0] [--lines=N]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::signal(SIGINT, signal_handler);
+  std::signal(SIGTERM, signal_handler);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(options.port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listener, 256) != 0) {
+    std::cerr << "Cannot listen on 127.0.0.1:" << options.port << ": " << strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "lrclib mock on http://127.0.0.1:" << options.port << " latency " << options.latencyMs << "+" << options.jitterMs << " ms, errors " << options.errorRate << ", missing " << options.missingRate << std::endl;
+  while (running) {
+    struct pollfd pfd = {listener, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::thread(serveConnection, fd).detach();
+  }
+  close(listener);
+  std::cout << "served " << served << ", not found " << notFound << ", errors " << failed << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -17,13 +17,41 @@
  */
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include <cstdlib>
+#include <iomanip>
 #include <curl/curl.h>
 #include "json.hpp"
 
 using json = nlohmann::json;
 
+// One line of a batch file: artist<TAB>title<TAB>output file
+struct Job {
+  std::string artist;
+  std::string title;
+  std::string output;
+};
+
+// A job on its way through curl_multi
+struct Transfer {
+  Job job;
+  std::string response;
+  int attempts = 0;
+  std::chrono::steady_clock::time_point due; // when a retry may start
+  std::chrono::steady_clock::time_point started;
+};
+
+// Read batch jobs, blank lines and lines starting with # are skipped
+std::vector<Job> readJobs(std::istream &in);
+// Fetch every job through curl_multi and print a summary, returns the number of failed jobs
+int runBatch(const std::vector<Job> &jobs, const std::string &baseUrl, int parallel, int retries);
+
 // Callback function to write received data into a string
 static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
   size_t totalSize = size * nmemb;
@@ -32,72 +60,276 @@ static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* use
   return totalSize;
 }
 
-bool fetchLyricsToFile(const std::string& url, const std::string& outputFile) {
-  CURL* curl;
+// Handle with the options every request uses, reused so later requests keep the connection
+CURL *makeHandle() {
+  CURL *curl = curl_easy_init();
+  if (!curl) {
+    return nullptr;
+  }
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "Chrome Fetcher/1.0");
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  return curl;
+}
+
+bool fetchLyricsToFile(CURL *curl, const std::string& url, const std::string& outputFile) {
   CURLcode res;
   std::string response;
   long int http_code = 0;
 
-  curl_global_init(CURL_GLOBAL_DEFAULT);
-  curl = curl_easy_init();
-
-  if (!curl) {
-    std::cerr << "Failed to initialize cURL.\n";
-    curl_global_cleanup();
-    return false;
-  }
-
-  // Set cURL options
   curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, "Chrome Fetcher/1.0");
 
   // Perform the request
   res = curl_easy_perform(curl);
 
   if (res != CURLE_OK) {
     std::cerr << "cURL error: " << curl_easy_strerror(res) << std::endl;
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
     return false;
   }
 
-  if (res == CURLE_OK) {
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code == 404) {
-      return false;
-    }
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code == 404) {
+    return false;
   }
 
-
   // Save to .lrc file
   std::ofstream outFile(outputFile, std::ios::out | std::ios::trunc);
   if (!outFile) {
     std::cerr << "Error opening file for writing: " << outputFile << std::endl;
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
     return false;
   }
   outFile << response;
   outFile.close();
 
   std::cout << "Lyrics saved to: " << outputFile << std::endl;
-
-  // Cleanup
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
   return true;
 }
 
+std::vector<Job> readJobs(std::istream &in) {
+  std::vector<Job> jobs;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    Job job;
+    if (std::getline(iss, job.artist, '\t') && std::getline(iss, job.title, '\t') && std::getline(iss, job.output) && !job.output.empty()) {
+      jobs.push_back(job);
+    }
+    else {
+      std::cerr << "Skipping malformed job: " << line << std::endl;
+    }
+  }
+  return jobs;
+}
+
+// Lookup URL of a job, artist and title are percent encoded
+static std::string jobUrl(CURL *curl, const std::string &baseUrl, const Job &job) {
+  char *artist = curl_easy_escape(curl, job.artist.c_str(), static_cast<int>(job.artist.size()));
+  char *title = curl_easy_escape(curl, job.title.c_str(), static_cast<int>(job.title.size()));
+  std::string url = baseUrl + "/api/get?artist_name=" + (artist ? artist : "") + "&track_name=" + (title ? title : "");
+  curl_free(artist);
+  curl_free(title);
+  return url;
+}
+
+int runBatch(const std::vector<Job> &jobs, const std::string &baseUrl, int parallel, int retries) {
+  using clock = std::chrono::steady_clock;
+  CURLM *multi = curl_multi_init();
+  // Requests to the same host share one HTTP/2 connection when the server speaks it
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(parallel));
+  std::deque<Transfer *> waiting;
+  for (auto &job : jobs) {
+    waiting.push_back(new Transfer{job, {}, 0, clock::now(), {}});
+  }
+  std::vector<CURL *> idle;
+  int active = 0;
+  int saved = 0, notFound = 0, failed = 0, retried = 0;
+  double downloaded = 0;
+  std::vector<double> latencies; // ms, successful attempts only
+  std::mt19937 rng(std::random_device{}());
+  auto start = clock::now();
+
+  while (!waiting.empty() || active > 0) {
+    // Start whatever is due, up to the concurrency limit. Retries are queued at the back
+    // sorted by due time, so the first not-due entry ends the scan.
+    auto now = clock::now();
+    while (active < parallel && !waiting.empty() && waiting.front()->due <= now) {
+      Transfer *transfer = waiting.front();
+      waiting.pop_front();
+      CURL *curl = nullptr;
+      if (!idle.empty()) {
+        curl = idle.back();
+        idle.pop_back();
+      }
+      else if ((curl = makeHandle())) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L); // wait for a connection to multiplex on
+      }
+      if (!curl) {
+        std::cerr << "Cannot create a cURL handle for " << transfer->job.artist << " - " << transfer->job.title << std::endl;
+        failed++;
+        delete transfer;
+        continue;
+      }
+      transfer->response.clear();
+      transfer->attempts++;
+      transfer->started = now;
+      curl_easy_setopt(curl, CURLOPT_URL, jobUrl(curl, baseUrl, transfer->job).c_str());
+      curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer->response);
+      curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+      if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+        std::cerr << "Cannot start the request for " << transfer->job.artist << " - " << transfer->job.title << std::endl;
+        idle.push_back(curl);
+        failed++;
+        delete transfer;
+        continue;
+      }
+      active++;
+    }
+
+    int running = 0;
+    curl_multi_perform(multi, &running);
+    CURLMsg *msg;
+    int queued = 0;
+    while ((msg = curl_multi_info_read(multi, &queued))) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      CURL *curl = msg->easy_handle;
+      CURLcode res = msg->data.result;
+      Transfer *transfer = nullptr;
+      long int http_code = 0;
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, reinterpret_cast<char **>(&transfer));
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+      curl_multi_remove_handle(multi, curl);
+      idle.push_back(curl);
+      active--;
+      double ms = std::chrono::duration<double, std::milli>(clock::now() - transfer->started).count();
+      if (res == CURLE_OK && http_code == 404) {
+        notFound++;
+        delete transfer;
+        continue;
+      }
+      if (res == CURLE_OK && http_code < 400) {
+        latencies.push_back(ms);
+        downloaded += static_cast<double>(transfer->response.size());
+        std::ofstream outFile(transfer->job.output, std::ios::out | std::ios::trunc);
+        if (outFile << transfer->response) {
+          saved++;
+        }
+        else {
+          std::cerr << "Error opening file for writing: " << transfer->job.output << std::endl;
+          failed++;
+        }
+        delete transfer;
+        continue;
+      }
+      // Network errors, 429 and 5xx are retried with exponential backoff and jitter, other
+      // statuses would only be refused again
+      bool transient = res != CURLE_OK || http_code == 429 || http_code >= 500;
+      if (transient && transfer->attempts <= retries) {
+        retried++;
+        std::uniform_int_distribution<int> jitter(0, 250);
+        transfer->due = clock::now() + std::chrono::milliseconds((500 << (transfer->attempts - 1)) + jitter(rng));
+        auto pos = std::upper_bound(waiting.begin(), waiting.end(), transfer, [](const Transfer *a, const Transfer *b) { return a->due < b->due; });
+        waiting.insert(pos, transfer);
+        continue;
+      }
+      if (res != CURLE_OK) {
+        std::cerr << "cURL error: " << curl_easy_strerror(res) << " for " << transfer->job.artist << " - " << transfer->job.title << std::endl;
+      }
+      else {
+        std::cerr << "HTTP " << http_code << " for " << transfer->job.artist << " - " << transfer->job.title << std::endl;
+      }
+      failed++;
+      delete transfer;
+    }
+
+    // Sleep until there is socket activity, or the next retry is due
+    int timeoutMs = 1000;
+    if (!waiting.empty() && active < parallel) {
+      auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(waiting.front()->due - clock::now()).count();
+      timeoutMs = static_cast<int>(std::clamp<long long>(wait, 0, 1000));
+    }
+    if (active > 0 || timeoutMs > 0) {
+      curl_multi_poll(multi, nullptr, 0, timeoutMs, nullptr);
+    }
+  }
+
+  for (CURL *curl : idle) {
+    curl_easy_cleanup(curl);
+  }
+  curl_multi_cleanup(multi);
+
+  double seconds = std::chrono::duration<double>(clock::now() - start).count();
+  std::stable_sort(latencies.begin(), latencies.end()); // std::sort trips -Wstrict-overflow in its heap fallback
+  auto percentile = [&](double p) {
+    return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))];
+  };
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << jobs.size() << " jobs in " << seconds << " s (" << static_cast<double>(jobs.size()) / std::max(seconds, 1e-9) << " jobs/s, " << downloaded / 1024.0 / std::max(seconds, 1e-9) << " KiB/s), " << parallel << " parallel" << std::endl;
+  std::cout << "saved " << saved << ", not found " << notFound << ", failed " << failed << ", retries " << retried << std::endl;
+  std::cout << "latency ms: p50 " << percentile(0.5) << " p90 " << percentile(0.9) << " p99 " << percentile(0.99) << " max " << (latencies.empty() ? 0.0 : latencies.back()) << std::endl;
+  return failed;
+}
+
 int main(int argc, char *argv[]) {
+  // Batch mode: lyrics_fetcher --batch=jobs.txt|- [--parallel=N] [--retries=N] [--url=https://lrclib.net]
+  std::string batchFile;
+  std::string baseUrl = "https://lrclib.net";
+  int parallel = 8;
+  int retries = 3;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--batch=", 0) == 0) {
+      batchFile = arg.substr(8);
+    }
+    else if (arg.rfind("--parallel=", 0) == 0) {
+      parallel = std::clamp(std::atoi(arg.c_str() + 11), 1, 256);
+    }
+    else if (arg.rfind("--retries=", 0) == 0) {
+      retries = std::clamp(std::atoi(arg.c_str() + 10), 0, 10);
+    }
+    else if (arg.rfind("--url=", 0) == 0) {
+      baseUrl = arg.substr(6);
+    }
+  }
+  if (!batchFile.empty()) {
+    std::vector<Job> jobs;
+    if (batchFile == "-") {
+      jobs = readJobs(std::cin);
+    }
+    else {
+      std::ifstream in(batchFile);
+      if (!in) { std::cerr << "Cannot open " << batchFile << std::endl; return EXIT_FAILURE; }
+      jobs = readJobs(in);
+    }
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    int failed = runBatch(jobs, baseUrl, parallel, retries);
+    curl_global_cleanup();
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   //std::string apiUrl = "https://lrclib.net/api/get?artist_name=50 Cent - Ayo Technology (Official Music Video) ft. Justin Timberlake&album_name=Unknown Album&track_name=50 Cent - Ayo Technology (Official Music Video) ft. Justin Timberlake";
-  if (argc < 3) { std::cerr << argv[0] << " expected 'url' 'file.lrc'" << std::endl; return EXIT_FAILURE; }
+  if (argc < 3) { std::cerr << argv[0] << " expected 'url' 'file.lrc', or --batch=jobs.txt (- for stdin) with artist<TAB>title<TAB>file.lrc lines" << std::endl; return EXIT_FAILURE; }
   std::string apiUrl = argv[1];
   std::string outputFile = argv[2];
 
-  if (!fetchLyricsToFile(apiUrl, outputFile)) {
+  // Set up once per process, curl_global_init is not thread safe
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  CURL *curl = makeHandle();
+  if (!curl) {
+    std::cerr << "Failed to initialize cURL.\n";
+    curl_global_cleanup();
+    return EXIT_FAILURE;
+  }
+  bool fetched = fetchLyricsToFile(curl, apiUrl, outputFile);
+  curl_easy_cleanup(curl);
+  curl_global_cleanup();
+  if (!fetched) {
     std::cerr << "Failed to fetch lyrics.\n";
     return EXIT_FAILURE;
   }
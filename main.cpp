@@ -25,7 +25,9 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cctype>
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
 #include <cmath>
 #include <thread>
@@ -34,15 +36,45 @@
 #include <regex>
 #include <atomic>
 #include <csignal>
+#include <clocale>
+#include <cwchar>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <string_view>
+#include <charconv>
+#include <bit>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pty.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <zlib.h>
 #include <SFML/Audio.hpp>
 #include <ncurses.h>
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
+#include <taglib/tpropertymap.h>
+#include <taglib/mpegfile.h>
+#include <taglib/id3v2tag.h>
+#include <taglib/synchronizedlyricsframe.h>
 #include <mpg123.h>
 #include <curl/curl.h>
 #include <vlc/vlc.h>
 #include "json.hpp"
 
+// Terminal columns of a string, worked out once so drawing never rescans it
+struct TextLayout {
+  int width = 0;
+  // Byte offset where each grapheme cluster ends and the columns up to it, empty for plain ASCII
+  std::vector<std::pair<uint32_t, uint32_t>> clusters;
+};
+
 struct Track {
   std::string path;
   std::string name;
@@ -50,17 +82,578 @@ struct Track {
   std::string artist;
   std::string album;
   std::string duration;
+  TextLayout titleLayout;
+  float seconds = 0.f; // length, 0 when unknown
+  bool embeddedLyrics = false; // the tags carry lyrics (ID3 USLT/SYLT, Vorbis/FLAC LYRICS)
+  bool embeddedSynced = false; // and they are known to have timestamps (SYLT), LYRICS tags are only parsed when read
+};
+
+// Word timing from enhanced LRC (<mm:ss.xx> tags)
+struct LyricWord {
+  float time; // seconds
+  uint32_t offset; // byte offset of the word in LyricLine::text
 };
 
 struct LyricLine {
   float time; // seconds
   std::string text;
+  TextLayout layout;
+  std::vector<LyricWord> words; // empty unless the line had word timings
+};
+
+// How the gains of two overlapping tracks move during a crossfade
+enum class FadeCurve {
+  Linear,
+  EqualPower, // constant loudness for unrelated material
+  SCurve      // smoothstep, lingers on both ends
+};
+
+// Options from the config file that are not key bindings
+struct Settings {
+  int lyricsFps = 30; // redraw rate while lyrics scroll, 30 to 60
+  size_t lyricsCacheBytes = 16 << 20; // parsed lyrics kept in memory
+  int lyricsPrefetch = 3; // upcoming tracks whose lyrics are fetched ahead, 0 turns it off
+  int lyricsRate = 12; // lookups per minute for prefetching, the playing track never waits
+  size_t lyricsStoreBytes = 64 << 20; // size cap of the lyrics store on disk
+  size_t seekIndexBytes = 16 << 20; // size cap of the MP3 seek indexes on disk
+  int lyricsMissDays = 7; // how long lrclib having no lyrics for a track is believed
+  int lyricsErrorMinutes = 10; // how long a failed lookup waits before it is tried again
+  std::string lrclibUrl = "https://lrclib.net"; // lyrics server, point it at lrclib_mock for testing
+  int audioBufferMs = 100; // audio per buffer handed to the sound card, 20 to 1000
+  int audioReadAheadMs = 2000; // audio decoded ahead of playback, 200 to 10000
+  float crossfade = 0.f; // seconds the end of a track overlaps the next one, 0 joins them gapless
+  FadeCurve crossfadeCurve = FadeCurve::EqualPower;
+};
+
+// The fields of an lrclib response the player reads
+struct LrclibLyrics {
+  std::string synced; // LRC text, empty when lrclib has none
+  std::string plain;
+  float duration = 0.f; // seconds
+};
+
+// Outcome of an lrclib request
+enum class FetchStatus {
+  Ok,
+  NotFound, // lrclib has no lyrics for the track
+  Error     // network or server trouble, worth retrying later
+};
+
+// Lyrics of one track, handed from the lyrics worker to the render thread
+struct LyricsResult {
+  uint64_t id = 0; // trackId() of the track the lyrics belong to
+  bool found = false;
+  std::vector<LyricLine> lines;
+};
+
+// Parsed lyrics by track ID, the least recently used are evicted once over the byte budget
+struct LyricsCache {
+  std::shared_ptr<const LyricsResult> get(uint64_t id);
+  void put(std::shared_ptr<const LyricsResult> lyrics);
+  void setCapacity(size_t bytes);
+private:
+  void evict();
+  std::mutex mutex;
+  std::list<std::shared_ptr<const LyricsResult>> order; // most recently used first
+  std::unordered_map<uint64_t, std::list<std::shared_ptr<const LyricsResult>>::iterator> index;
+  size_t bytes = 0;
+  size_t capacity = 16 << 20;
+};
+
+// Lyrics fetched from lrclib, kept in one append-only data file under the cache directory
+// instead of next to the songs. Records are zlib compressed and the index maps a track ID to
+// its record, so a lookup is one pread(). Over the size cap the least recently used records
+// are dropped and the data file is rewritten.
+struct LyricsStore {
+  bool open(const std::string &dir, size_t capacity);
+  // Write the index back, records appended since the last save are found again by scanning
+  void close();
+  // LRC text of a track, false when it is not stored. plain is set for lyrics without timestamps.
+  bool get(uint64_t id, std::string &lrc, bool &plain);
+  // Like get, but does not count as a use, so the song is not kept longer when the store is compacted
+  bool peek(uint64_t id, std::string &lrc, bool &plain);
+  void put(uint64_t id, std::string_view lrc, bool plain);
+  // Whether a track's lyrics are stored, without reading them
+  bool contains(uint64_t id);
+  // Remember that a track has no lyrics for ttl, so it is not asked for again until then
+  void putMissing(uint64_t id, std::chrono::seconds ttl);
+  // Whether a lookup for the track failed recently enough to skip the network
+  bool missing(uint64_t id);
+private:
+  // Written in front of every record in the data file, so the index can be rebuilt from it
+  struct RecordHeader {
+    uint32_t magic;
+    uint32_t size; // compressed
+    uint32_t rawSize;
+    uint32_t flags; // LYRICS_PLAIN
+    uint64_t id;
+  };
+  struct Record {
+    uint64_t id;
+    uint64_t offset; // of the compressed text, just past its header
+    uint32_t size;
+    uint32_t rawSize;
+    uint64_t used; // LRU clock
+    uint32_t flags;
+    uint32_t reserved;
+  };
+  void load();
+  void loadMisses();
+  bool read(uint64_t id, std::string &lrc, bool &plain, bool use);
+  void scan(uint64_t from);
+  // flock the data file against other players and the prefetcher, then catch up with what they wrote
+  bool lockData();
+  void unlockData();
+  void compact();
+  void saveIndex();
+  std::mutex mutex;
+  std::string dataPath;
+  std::string indexPath;
+  std::string missPath;
+  int fd = -1;
+  ino_t inode = 0; // of the data file the records describe
+  std::unordered_map<uint64_t, Record> records;
+  std::unordered_map<uint64_t, int64_t> misses; // track ID to the unix time the miss expires
+  uint64_t end = 0;  // size of the data file
+  uint64_t live = 0; // bytes of the data file still referenced by the index
+  uint64_t clock = 0;
+  size_t capacity = 64 << 20;
+};
+
+// Long lived HTTP client: curl is set up once, easy handles are pooled and DNS, connections and
+// TLS sessions are shared between them, so a warm request skips the lookup and both handshakes.
+struct HttpClient {
+  bool init();
+  void cleanup();
+  // GET url into response
+  FetchStatus get(const std::string &url, std::string &response);
+  // Percent encode text for a query string
+  std::string escape(std::string_view text);
+  std::atomic<uint64_t> requests{0}; // sent so far, read by --bench-lyrics
+private:
+  CURL *acquire();
+  void release(CURL *curl);
+  static void lockShare(CURL *curl, curl_lock_data data, curl_lock_access access, void *userp);
+  static void unlockShare(CURL *curl, curl_lock_data data, void *userp);
+  CURLSH *share = nullptr;
+  std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+  std::mutex poolMutex;
+  std::vector<CURL *> pool; // idle handles, they keep their options between requests
+};
+
+// Background lyrics fetcher, the render thread only queues requests and picks up results.
+// Requests for tracks that stopped playing are dropped before and after the network round trip.
+struct LyricsWorker {
+  void start();
+  void stop();
+  // Ask for the lyrics of a track, returns immediately
+  void request(const Track &track);
+  // Replace the tracks to fetch ahead of time, in play order
+  void prefetch(std::vector<Track> tracks);
+  // Finished lyrics for a track, null while they are still being fetched
+  std::shared_ptr<const LyricsResult> result(const Track &track);
+  void setPrefetchRate(int perMinute);
+  LyricsCache cache;
+private:
+  void run();
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Track> queue;
+  std::deque<Track> upcoming; // prefetches, only served when queue is empty and a token is free
+  double rate = 0.2; // prefetch tokens per second, the bucket holds at most burst
+  double burst = 3.0;
+  uint64_t wanted = 0; // track the UI is waiting for
+  uint64_t loading = 0; // track being fetched right now
+  std::shared_ptr<const LyricsResult> latest; // last lookup, kept even when nothing was found
+  bool stopping = false;
+};
+
+// Where a lyrics search matched: the track and when the matching line is sung
+struct LyricsHit {
+  uint64_t id;
+  float time;   // seconds
+  int matches;  // times the phrase occurs in the song
+};
+
+// Inverted index over the words of every lyrics the player has seen, filled as lyrics arrive.
+// Postings are (song, word position) pairs, delta and varint coded in blocks with a skip entry
+// each. A phrase starts from its rarest word and only probes the blocks of the other words
+// where a match could be. A last word of three letters or more also matches as a prefix.
+struct LyricsIndex {
+  void add(uint64_t id, const std::vector<LyricLine> &lines);
+  bool contains(uint64_t id);
+  // Songs containing the phrase, most matches first
+  std::vector<LyricsHit> search(std::string_view query, size_t limit);
+  size_t songs();
+  size_t bytes(); // rough heap footprint
+private:
+  static constexpr uint32_t blockSize = 64;
+  // Keys are song << 32 | position, each block starts with an absolute key
+  struct Postings {
+    std::string data;
+    std::vector<std::pair<uint64_t, uint32_t>> skips; // first key and byte offset of every block
+    uint32_t count = 0;
+    uint32_t lastDoc = 0;
+    uint32_t lastPos = 0;
+  };
+  // Walks one postings list forward, skipping whole blocks
+  struct Cursor {
+    const Postings *postings;
+    size_t block = 0;
+    uint32_t entry = 0; // index of the entry key holds
+    const char *at = nullptr;
+    uint64_t key = 0;
+    bool next();
+    bool seek(uint64_t target); // first key >= target, false at the end
+  };
+  struct Doc {
+    uint64_t id;
+    std::vector<uint32_t> lineStarts; // word position each line starts at
+    std::vector<float> times;
+  };
+  // Postings of a word, or of every word starting with it
+  std::vector<const Postings *> lookup(const std::string &word, bool prefix) const;
+  // Sorted keys of all the lists, moved back by offset words
+  static std::vector<uint64_t> decode(const std::vector<const Postings *> &lists, size_t offset);
+  std::mutex mutex;
+  std::map<std::string, Postings, std::less<>> words; // ordered, so a prefix is one range
+  std::vector<Doc> docs;
+  std::unordered_set<uint64_t> ids;
+};
+
+// Where playback is in a sorted lyric timeline. Normal playback moves the cursor by at most
+// one line per frame in O(1), anything else (seeks, new lyrics) binary searches.
+struct LyricTimeline {
+  // Move to time t, lyrics may change between calls
+  void update(const LyricsResult &lyrics, float t, float duration);
+  size_t line = 0;    // current line, 0 also before the first line starts
+  float scroll = 0.f; // how far through the current line we are, 1.0 = one line height
+private:
+  uint64_t id = 0;
+  const LyricsResult *current = nullptr;
+};
+
+// Source of interleaved 16-bit PCM for the audio stream
+struct Decoder {
+  virtual ~Decoder() = default;
+  // Up to count samples, fewer only at the end of the track
+  size_t read(int16_t *samples, size_t count);
+  bool seek(uint64_t frame);
+  // Decode the first samples now, so starting the track later needs no disk access
+  void preroll(size_t count);
+  unsigned int channels = 0;
+  unsigned int rate = 0;
+  uint64_t frames = 0;   // length, 0 when unknown
+  uint64_t position = 0; // frame the next read() starts at
+  std::string source;    // file being decoded, set by openDecoder()
+protected:
+  virtual size_t decode(int16_t *samples, size_t count) = 0;
+  virtual bool seekFrame(uint64_t frame) = 0;
+private:
+  std::vector<int16_t> prerolled;
+  size_t prerolledAt = 0;
+};
+
+constexpr long SEEK_INDEX_ENTRIES = 8192; // mpg123 doubles the step when full, so at most 64 KiB a file
+constexpr std::chrono::milliseconds SEEK_INDEX_SLOW(50); // a seek taking longer gets the file indexed
+
+// mpg123 only knows where the frames of a VBR MP3 start once it has read up to them, so a fresh
+// handle seeking deep into a long file reads everything before the target. The first time a seek
+// in an MP3 is slow, a background thread scans it once and keeps the frame index in the cache,
+// keyed by path and checked against size and mtime; every later open hands it to mpg123 and
+// seeks go straight to the nearest indexed frame.
+struct SeekIndexer {
+  void start(const std::string &dir, size_t capacity);
+  void stop();
+  // Scan path unless it is indexed, queued or failed to scan before, returns immediately
+  void request(const std::string &path);
+  // Give mpg123 the stored index of path, false when there is none for the file as it is now.
+  // frames is the exact length the scan found.
+  bool load(const std::string &path, mpg123_handle *handle, uint64_t &frames);
+private:
+  // What is known of a file's index, a file without one is not looked for on disk again
+  enum class State { Absent, Stored, Failed };
+  void run();
+  bool build(const std::string &path);
+  void prune();
+  std::string file(const std::string &path) const;
+  std::string dir; // set before any decoder opens, not changed after
+  size_t capacity = 16 << 20;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::string> queue;
+  std::unordered_map<std::string, State> known;
+  bool stopping = false;
+};
+
+// MP3 through mpg123 in gapless mode, the LAME encoder delay and padding are cut off
+struct Mpg123Decoder : Decoder {
+  ~Mpg123Decoder() override;
+  bool open(const std::string &path);
+protected:
+  size_t decode(int16_t *samples, size_t count) override;
+  bool seekFrame(uint64_t frame) override;
+private:
+  mpg123_handle *handle = nullptr;
+  std::string path;
+  bool indexed = false; // has the stored seek index
+};
+
+// WAV read directly: 8 to 32 bit integer and 32 or 64 bit float PCM, SFML rejects the float ones
+struct WavDecoder : Decoder {
+  bool open(const std::string &path);
+protected:
+  size_t decode(int16_t *samples, size_t count) override;
+  bool seekFrame(uint64_t frame) override;
+private:
+  std::ifstream file;
+  bool floating = false;
+  unsigned int bytes = 0;  // per sample
+  uint64_t dataStart = 0;  // file offset of the first sample
+  uint64_t remaining = 0;  // bytes of sample data left
+  std::vector<unsigned char> raw;
+};
+
+// Everything else SFML reads: FLAC and Ogg Vorbis
+struct SoundFileDecoder : Decoder {
+  bool open(const std::string &path);
+protected:
+  size_t decode(int16_t *samples, size_t count) override;
+  bool seekFrame(uint64_t frame) override;
+private:
+  sf::InputSoundFile file;
+};
+
+// Single producer, single consumer ring of samples. push() and pop() never lock, allocate or
+// wait; allocate() and reset() need both sides stopped.
+struct SampleRing {
+  void allocate(size_t capacity);
+  void reset();
+  size_t push(const int16_t *samples, size_t count); // producer, returns how many fit
+  size_t pop(int16_t *samples, size_t count);        // consumer, returns how many there were
+  size_t size() const;
+  size_t capacity() const { return length.load(std::memory_order_relaxed); }
+private:
+  std::vector<int16_t> data;
+  std::atomic<size_t> length{0}; // data.size(), for other threads asking how full it is
+  alignas(64) std::atomic<size_t> head{0}; // samples ever pushed, written by the producer only
+  alignas(64) std::atomic<size_t> tail{0}; // samples ever popped, written by the consumer only
+};
+
+// Local files play through this instead of sf::Music. Our decoders feed one continuous stream,
+// so the next track is opened and prerolled while the current one plays and its first sample
+// follows the last sample of the current one, with no gap and no silence in between.
+// A decode thread keeps a ring filled ahead of playback and SFML's streaming thread only copies
+// out of it, so a slow disk has the length of the ring to catch up before anything is heard.
+class AudioStream : public sf::SoundStream {
+public:
+  ~AudioStream() override;
+  // Play a file from the start, false when it cannot be decoded
+  bool open(const std::string &path);
+  // Audio handed to SFML per call, it keeps three of them queued. Shorter means pause, seek
+  // and skip are heard sooner, longer means fewer wakeups; applies from the next open().
+  void setBufferLength(int milliseconds);
+  // Audio decoded ahead of playback, applies from the next open()
+  void setReadAhead(int milliseconds);
+  // Share of the ring that is filled, and how often the streaming thread found it short
+  float fill() const;
+  uint64_t underruns() const { return underrunCount; }
+  // Track to continue with when the current one ends, an empty path clears it. Tracks with
+  // another sample rate or channel count cannot be joined, the stream stops before them.
+  // Ignored while the queued track is spliced in but not heard yet, queue again after advanced().
+  void queue(const std::string &path);
+  // Fade from the current track into path from where playback is now, false when
+  // crossfading is off or the formats differ, then the caller opens it instead
+  bool fadeTo(const std::string &path);
+  void setCrossfade(float seconds, FadeCurve curve);
+  // True once after the queued track became audible, path is then the file being heard
+  bool advanced(std::string &path);
+  // Seconds into the track being heard
+  float position();
+  float duration();
+  void seek(float seconds);
+protected:
+  bool onGetData(Chunk &data) override;
+  void onSeek(sf::Time offset) override;
+private:
+  void produce();
+  size_t decodeBlock(std::unique_lock<std::mutex> *lock);
+  size_t readFrom(Decoder &decoder, int16_t *samples, size_t count, std::unique_lock<std::mutex> *lock);
+  void waitIdle(std::unique_lock<std::mutex> &lock);
+  void refill();
+  uint64_t heardFrame();
+  void settle();
+  void startFade(uint64_t at, bool automatic);
+  size_t fadeInto(size_t offset, std::unique_lock<std::mutex> *lock);
+  std::mutex mutex; // guards everything below, the decode thread lets go of it while it reads
+  std::condition_variable wake; // for the decode thread, when there is something new to decode
+  std::condition_variable idle; // for the others, when the decode thread is done reading
+  bool reading = false; // the decode thread is inside a decoder, current, previous and the buffers stay as they are
+  int waiters = 0;      // in waitIdle(), the decode thread lets them in before its next block
+  std::thread producer;
+  bool quit = false;
+  std::unique_ptr<Decoder> current;  // being decoded
+  std::unique_ptr<Decoder> next;     // queued
+  std::unique_ptr<Decoder> previous; // still heard after a splice until settle(), or fading out
+  std::unique_ptr<Decoder> pendingFade; // fadeTo() hands it to onSeek()
+  sf::Time fadeOffset;                  // and the offset the fade starts at
+  bool seeking = false; // seek() is in setPlayingOffset(), the rewind of its stop() is skipped
+  SampleRing ring;
+  std::vector<int16_t> buffer; // one block of the decode thread
+  std::vector<int16_t> output; // one chunk for SFML, only the streaming thread touches it
+  int bufferMs = 100;
+  int readAheadMs = 2000;
+  std::atomic<bool> ended{false};           // the decode thread has nothing more to add
+  std::atomic<uint64_t> underrunCount{0};
+  std::atomic<uint64_t> silence{0};         // frames of silence played on underruns, since the last seek
+  std::vector<int16_t> fadeOut; // scratch for the two sides of a crossfade
+  std::vector<int16_t> fadeIn;
+  uint64_t decoded = 0;    // stream frames put into the ring, counted from the last seek
+  uint64_t trackStart = 0; // stream frame the track being heard started at
+  uint64_t spliceAt = 0;   // stream frame current starts at while previous is still heard
+  bool spliced = false;
+  bool automatic = false;  // the splice came from the queue, not from fadeTo()
+  bool advance = false;
+  std::string advancedPath; // what advanced() reports
+  float crossfade = 0.f;   // seconds
+  FadeCurve curve = FadeCurve::EqualPower;
+  bool fading = false;
+  uint64_t fadeAt = 0;     // frames into the fade
+  uint64_t fadeLength = 0;
+};
+
+// out = a * gain a + b * gain b, both gains ramping linearly from sample to sample
+void mixFade(const int16_t *a, const int16_t *b, int16_t *out, size_t count, float gainA, float stepA, float gainB, float stepB);
+// Gains of the outgoing and incoming track x of the way through a fade
+void fadeGains(FadeCurve curve, float x, float &out, float &in);
+
+// Open a decoder for a local file by its extension
+std::unique_ptr<Decoder> openDecoder(const std::string &path);
+
+// Focus reports (xterm mode 1004) are mapped to these key codes
+constexpr int KEY_FOCUS_IN = KEY_MAX + 1;
+constexpr int KEY_FOCUS_OUT = KEY_MAX + 2;
+
+// Latency histogram in microseconds, 4 linear buckets per power of two
+struct Histogram {
+  static constexpr int buckets = 100;
+  std::atomic<uint64_t> counts[buckets] = {};
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> max{0};
+  void record(std::chrono::steady_clock::duration d);
+  float percentile(double p) const; // milliseconds
+};
+
+// One row of a stats table
+struct StatsLine {
+  const char *name;
+  const Histogram *hist;
+};
+
+// Counters behind the debug overlay and the --stats dump
+struct FrameStats {
+  Histogram draw;     // drawFrame, including the terminal write
+  Histogram input;    // getch until the frame showing its effect is on screen
+  Histogram lyrics;   // one lyrics lookup in the worker, fetch included
+  Histogram metadata; // readMetadata
+  Histogram decode;   // one block of the audio decode thread, decoding and mixing
+  Histogram seek;     // moving a decoder to another frame
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> bytes{0}; // written to the terminal by drawFrame
+  std::atomic<float> fps{0.f};
+  std::atomic<float> bytesPerSecond{0.f};
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+};
+
+// Immutable snapshot of the player, published by the control thread and drawn by the render thread
+struct PlayerState {
+  std::shared_ptr<const std::vector<Track>> playlist;
+  std::shared_ptr<const std::unordered_map<std::string, int>> keys;
+  Track track; // the track that is playing, lyrics are drawn for it
+  bool hasTrack = false;
+  std::string trackName = "No track selected";
+  TextLayout trackNameLayout;
+  std::string status = "Stopped";
+  std::string searchQuery;
+  std::string message;
+  int colorPair = 3;
+  int highlight = 0;
+  int offset = 0;
+  bool shuffle = false;
+  bool repeat = false;
+  float volume = 100.f;
+  int showHideAlbum = 0;
+  int showHideArtist = 0;
+  int showHideLyrics = 0;
+  int showOnlineRadio = 0;
+  sf::SoundSource::Status musicStatus = sf::SoundSource::Stopped;
+  float elapsed = 0.f; // seconds, as of stamp
+  float total = 0.f;
+  std::chrono::steady_clock::time_point stamp;
+  bool showStats = false;
+  bool focused = true; // false while the terminal reports it lost focus
+  uint64_t inputSeq = 0; // bumped for every batch of keys
+  std::chrono::steady_clock::time_point inputStamp; // when the first key of the batch was read
 };
 
-// Draw the lyrics for given song
-void drawLyrics(int rows, int cols, std::vector<Track> playlist);
+// Fetch and parse the lyrics of a track, runs on the lyrics worker. onRequest, when set, is called
+// right before lrclib is asked, lyrics found in the tags or the store never call it.
+LyricsResult loadTrackLyrics(const Track &track, const std::function<void()> &onRequest);
+// LRC text of a track from its tags, the lyrics store, or from lrclib into the store
+FetchStatus fetchTrackLyrics(const Track &track, std::string &lrc, const std::function<void()> &onRequest);
+// Lyrics of a track from the lyrics store, or from lrclib into the store. plain is set when
+// lrclib only had them without timestamps, lrc is then the bare text.
+static FetchStatus fetchStoredLyrics(const Track &track, std::string &lrc, bool &plain, const std::function<void()> &onRequest);
+// Move an lrclib answer older versions saved next to the song into the lyrics store
+static bool importLegacyLyrics(const Track &track, std::string &lrc);
+// Lyrics from the tags of a file, SYLT frames become LRC text, synced tells whether there were timestamps
+bool readEmbeddedLyrics(const std::string &path, std::string &text, bool &synced);
+// Turn unsynced lyrics into LRC text with the lines spread evenly over the track
+std::string spreadLyrics(std::string_view text, float seconds);
+// Fill the lyrics store for a whole library, resumable after an interruption
+int runLyricsPrefetch(const std::vector<Track> &tracks, int parallel);
+// Drive the lyrics worker through track changes against an lrclib server, lrclib_mock normally
+int runLyricsBenchmark(int trackCount, const std::string &url);
+// Index the lyrics store for search in the background, for the tracks of the library
+void indexStoredLyrics(std::vector<Track> tracks);
+// Build a lyrics index over synthetic songs and time phrase queries against it
+int runSearchBenchmark(int songCount);
+// Time the crossfade mixer on synthetic audio
+int runMixBenchmark(int seconds);
+// Draw the lyrics for given song, lyrics is null while they are still being fetched
+void drawLyrics(int rows, int cols, const PlayerState &state, const LyricsResult *lyrics);
 // Draw function tracks and status lines
-void drawStatus(int rows, int cols, std::vector<Track> playlist, int highlight, int colorPair, std::string status, int offset, bool shuffle, bool repeat, float volume, std::string &searchQuery, std::unordered_map<std::string, int> keys, int showHideAlbum, int showHideArtist, std::vector<Track> customPlaylist);
+void drawStatus(int rows, int cols, const PlayerState &state);
+// Draw one whole frame from a snapshot
+void drawFrame(const PlayerState &state, const LyricsResult *lyrics);
+// Render thread loop
+void renderLoop();
+// Publish a new snapshot and wake the render thread
+void publishState(std::shared_ptr<const PlayerState> state);
+// Wake the render thread without a new snapshot
+void wakeRender();
+// Playing offset of a snapshot, extrapolated to now
+float snapshotOffset(const PlayerState &state);
+// How long the screen stays valid for a snapshot, negative when only a new snapshot changes it
+std::chrono::milliseconds frameInterval(const PlayerState &state);
+// Wake the control thread from another thread
+void wakeControl();
+// Draw the frame time/latency overlay
+void drawStatsOverlay(int rows, int cols);
+// The player's histograms, in the order the overlay and --stats list them
+std::vector<StatsLine> playerStatsLines();
+// Print histograms as a table of count, p50, p99 and max in milliseconds
+void printStatsTable(std::ostream &out, const std::vector<StatsLine> &lines);
+// Print the collected stats, used by --stats on exit
+void dumpStats(std::ostream &out);
+// Bytes written so far by the calling thread, from /proc/thread-self/io
+uint64_t threadBytesWritten();
+// Curses setup shared by the player and the UI benchmark
+void setupScreen();
+// Headless UI benchmark: replay a key script against a synthetic library, drawing into a pty
+int runUiBenchmark(const std::string &script, int trackCount, int framesPerKey);
 // Filter playlist by search term
 std::vector<Track> filterTracks(const std::vector<Track> &tracks, const std::string &term);
 // List audio files in directory
@@ -71,16 +664,32 @@ std::vector<Track> listM3uFiles(const std::string &path);
 Track readMetadata(const std::filesystem::path &filePath);
 // Function to read the m3u metadata
 Track readM3uMetadata(const std::filesystem::path &filePath);
-// Parse .lrc file
-std::vector<LyricLine> loadLyrics(const std::string &filename);
+// Parse LRC text held in memory into a timeline sorted by time
+std::vector<LyricLine> parseLyrics(std::string_view text);
+// The std::regex LRC parser this replaced, kept for --bench-lrc
+std::vector<LyricLine> parseLyricsRegex(std::string_view text);
+// Time both LRC parsers on a file, or on a synthetic song when path is empty
+int runLrcBenchmark(const std::string &path);
 // Format seconds into mm:ss
 std::string formatTime(float duration);
+// Split UTF-8 text into grapheme clusters and measure its terminal width
+TextLayout layoutText(const std::string &text);
+// Stable ID of a track, keys the lyrics caches
+uint64_t trackId(const Track &track);
+// Longest prefix of text that fits in columns, cut between grapheme clusters
+std::string truncateToWidth(const std::string &text, const TextLayout &layout, int columns);
 // Draw progress bar with time
 void drawProgressBarWithTime(float elapsed, float total, int width, int y, int x);
 // Callback function to write received data into a string
 static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp);
-// fetch the and save the lyrics
-bool fetchLyricsToFile(const std::string &url, const std::string &outputFile);
+// Progress callback that aborts transfers once the player quits
+static int AbortCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+// Fetch the lrclib response for a track into response
+FetchStatus fetchLyrics(const std::string &url, std::string &response);
+// Pull syncedLyrics, plainLyrics and duration out of an lrclib response without building a DOM
+bool parseLrclibResponse(std::string_view body, LrclibLyrics &lyrics);
+// Per-user cache directory, $XDG_CACHE_HOME/0verau or ~/.cache/0verau
+std::string cacheDir();
 // Convert string to key code
 int keyFromString(const std::string &val);
 // Trim whitespace
@@ -94,9 +703,13 @@ static void handle_event(const libvlc_event_t* event, void* user_data);
 void signal_handler(int);
 // Load key bindings from config file
 std::unordered_map<std::string, int> loadKeyBindings(const std::string &configPath);
+// Load the options that are not key bindings from the config file
+Settings loadSettings(const std::string &configPath);
+// Whether a config file entry is an option rather than a key binding
+bool isSetting(const std::string &key);
 
-sf::Music music;
-int currentLine = 0;
+AudioStream music;
+LyricTimeline lyricTimeline; // render thread only
 int currentTrack = -1;
 std::vector<Track> playlist2;
 std::vector<Track> mp3Playlist;
@@ -108,32 +721,123 @@ std::atomic<bool> running(true);
 libvlc_media_t *media = nullptr;
 std::string trackName = "No track selected";
 std::string mp3Name = "";
+std::mutex vlcMetaMutex; // guards vlcSongMeta, written from the libvlc event thread
+std::atomic<bool> vlcMetaChanged(false);
+std::atomic<std::shared_ptr<const PlayerState>> playerState;
+std::mutex screenMutex; // ncurses is not thread safe, every curses call holds this
+std::mutex renderWakeMutex;
+std::condition_variable renderWake;
+bool renderPending = false;
+FrameStats stats;
+Settings settings;
+LyricsWorker lyricsWorker;
+LyricsStore lyricsStore;
+SeekIndexer seekIndexer;
+LyricsIndex lyricsIndex;
+HttpClient httpClient;
+int controlWakeFds[2] = {-1, -1}; // self-pipe, lets other threads interrupt the control thread's poll()
+std::atomic<bool> collectStats(false); // sample terminal bytes only while someone looks at them
 
 using json = nlohmann::json;
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) { std::cerr << "You must provide some folder with music in it and if you have radio.m3u folder (as second argument) for listening to online radio stations." << std::endl; return EXIT_FAILURE; }
+  setlocale(LC_ALL, ""); // UTF-8 titles and lyrics need a multibyte locale for curses and wcwidth
+  // Options start with -- and may appear anywhere, the rest are the music and radio folders
+  std::vector<std::string> args;
+  bool printStats = false;
+  bool benchUi = false;
+  bool benchLrc = false;
+  std::string benchLrcFile;
+  int prefetchParallel = 0;
+  int benchLyrics = 0;
+  int benchSearch = 0;
+  int benchMix = 0;
+  std::string lrclibUrl;
+  std::string benchKeys = "jjjjjjjjjjo$#jjjjjjjjjj%..........,,,,,%jjjjj^jjjj^&&&&&pp~%.....%~";
+  int benchTracks = 5000;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--stats") {
+      printStats = true;
+    }
+    else if (arg == "--bench-ui") {
+      benchUi = true;
+    }
+    else if (arg == "--bench-lrc" || arg.rfind("--bench-lrc=", 0) == 0) {
+      benchLrc = true;
+      benchLrcFile = (arg.size() > 12) ? arg.substr(12) : "";
+    }
+    else if (arg == "--prefetch-lyrics" || arg.rfind("--prefetch-lyrics=", 0) == 0) {
+      prefetchParallel = (arg.size() > 18) ? std::clamp(std::atoi(arg.c_str() + 18), 1, 32) : 4;
+    }
+    else if (arg == "--bench-lyrics" || arg.rfind("--bench-lyrics=", 0) == 0) {
+      benchLyrics = (arg.size() > 15) ? std::max(1, std::atoi(arg.c_str() + 15)) : 50;
+    }
+    else if (arg == "--bench-search" || arg.rfind("--bench-search=", 0) == 0) {
+      benchSearch = (arg.size() > 15) ? std::max(1, std::atoi(arg.c_str() + 15)) : 20000;
+    }
+    else if (arg == "--bench-mix" || arg.rfind("--bench-mix=", 0) == 0) {
+      benchMix = (arg.size() > 12) ? std::clamp(std::atoi(arg.c_str() + 12), 1, 12) : 6;
+    }
+    else if (arg.rfind("--lrclib=", 0) == 0) {
+      lrclibUrl = arg.substr(9, arg.find_last_not_of('/') - 8);
+    }
+    else if (arg.rfind("--bench-keys=", 0) == 0) {
+      benchKeys = arg.substr(13);
+    }
+    else if (arg.rfind("--bench-tracks=", 0) == 0) {
+      benchTracks = std::max(1, std::atoi(arg.c_str() + 15));
+    }
+    else {
+      args.push_back(arg);
+    }
+  }
+  if (benchUi) {
+    return runUiBenchmark(benchKeys, benchTracks, 30);
+  }
+  if (benchLrc) {
+    return runLrcBenchmark(benchLrcFile);
+  }
+  if (benchSearch > 0) {
+    return runSearchBenchmark(benchSearch);
+  }
+  if (benchMix > 0) {
+    return runMixBenchmark(benchMix);
+  }
+  if (benchLyrics > 0) {
+    return runLyricsBenchmark(benchLyrics, lrclibUrl.empty() ? "http://127.0.0.1:8080" : lrclibUrl);
+  }
+  if (args.empty()) { std::cerr << "You must provide some folder with music in it and if you have radio.m3u folder (as second argument) for listening to online radio stations." << std::endl; return EXIT_FAILURE; }
   std::signal(SIGINT, signal_handler);
-  std::string musicDir = argv[1]; // Change to your music folder
+  std::string musicDir = args[0]; // Change to your music folder
+  std::string radioDir = (args.size() > 1) ? args[1] : "";
+  collectStats = printStats;
   auto playlist = listAudioFiles(musicDir);
   if (playlist.empty()) { std::cerr << "No audio files found in " << musicDir << "\n"; return EXIT_FAILURE; }
 
   mp3Playlist = playlist;
   // Load key bindings from config file
-  auto keys = loadKeyBindings((getenv("HOME") ? static_cast<std::string>(getenv("HOME")) : static_cast<std::string>(".")) + static_cast<std::string>("/0verau.conf"));
+  std::string configPath = (getenv("HOME") ? static_cast<std::string>(getenv("HOME")) : static_cast<std::string>(".")) + static_cast<std::string>("/0verau.conf");
+  auto keys = loadKeyBindings(configPath);
+  settings = loadSettings(configPath);
+  if (!lrclibUrl.empty()) {
+    settings.lrclibUrl = lrclibUrl;
+  }
+  if (prefetchParallel > 0) {
+    return runLyricsPrefetch(playlist, prefetchParallel);
+  }
 
   // ncurses setup
   initscr();
-  start_color();
-  use_default_colors();
-  init_pair(1, COLOR_GREEN, -1); // Playing
-  init_pair(2, COLOR_YELLOW, -1); // Paused
-  init_pair(3, COLOR_RED, -1); // Stopped
-  noecho();
-  cbreak();
-  keypad(stdscr, TRUE);
-  curs_set(0);
-  timeout(200); // Non-blocking getch
+  setupScreen();
+  // Ask the terminal to report focus changes, terminals that don't know the mode ignore it
+  define_key("\033[I", KEY_FOCUS_IN);
+  define_key("\033[O", KEY_FOCUS_OUT);
+  fputs("\033[?1004h", stdout);
+  fflush(stdout);
+  if (pipe2(controlWakeFds, O_NONBLOCK | O_CLOEXEC) != 0) {
+    controlWakeFds[0] = controlWakeFds[1] = -1;
+  }
 
   int highlight = 0;
   int offset = 0;
@@ -144,8 +848,20 @@ int main(int argc, char *argv[]) {
   int showHideArtist = 0;
   int showHideLyrics = 0;
   int showOnlineRadio = 0;
+  int showStats = 0;
+  bool focused = true;
   float volume = 100.f;
   std::string searchQuery;
+  std::string message;
+  uint64_t inputSeq = 0;
+  std::chrono::steady_clock::time_point inputStamp;
+  Track nowPlaying;
+  bool hasNowPlaying = false;
+  std::mt19937 rng(std::random_device{}());
+  std::deque<int> shuffleOrder; // next shuffled tracks, drawn ahead so their lyrics can be prefetched
+  std::vector<float> lyricsJumps; // after a lyrics search, where each track of playlist starts playing
+  std::string layoutName;
+  TextLayout nameLayout = layoutText(trackName);
   const char *vlc_args[] = {
     "--no-xlib", // Avoid X11 dependency for headless
     "--quiet"
@@ -153,233 +869,461 @@ int main(int argc, char *argv[]) {
   libvlc_instance_t *vlc = libvlc_new(sizeof(vlc_args) / sizeof(vlc_args[0]), vlc_args);
   libvlc_media_player_t *player = nullptr;
   std::vector<std::string> parsedM3u;
-  if (argc > 2) {
-    playlist2 = listM3uFiles(argv[2]);
-    parsedM3u = parseM3U(listM3u(argv[2]));
+  if (!radioDir.empty()) {
+    playlist2 = listM3uFiles(radioDir);
+    parsedM3u = parseM3U(listM3u(radioDir));
     m3uPlaylist = playlist2;
   }
 
-  while (running) {
-    //clear();
-    werase(stdscr);
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
-    // Now Playing section
-    std::string status;
-    int colorPair = 3; // Default: stopped
-    if (music.getStatus() == sf::Music::Playing || vlcPlaying) {
-      status = "Playing";
-      colorPair = 1;
-    } else if (music.getStatus() == sf::Music::Paused || !vlcPlaying) {
-      status = "Paused";
-      colorPair = 2;
+  // The render thread only ever sees these shared copies, they are rebuilt when a list changes
+  auto sharedKeys = std::make_shared<const std::unordered_map<std::string, int>>(keys);
+  auto sharedPlaylist = std::make_shared<const std::vector<Track>>(playlist);
+  auto sharedPlaylist2 = std::make_shared<const std::vector<Track>>(playlist2);
+  auto snapshot = [&]() {
+    auto state = std::make_shared<PlayerState>();
+    state->playlist = (showOnlineRadio == 0) ? sharedPlaylist : sharedPlaylist2;
+    state->keys = sharedKeys;
+    state->musicStatus = music.getStatus();
+    if (state->musicStatus == sf::SoundSource::Playing || vlcPlaying) {
+      state->status = "Playing";
+      state->colorPair = 1;
+    } else if (state->musicStatus == sf::SoundSource::Paused || !vlcPlaying) {
+      state->status = "Paused";
+      state->colorPair = 2;
     } else {
-      status = "Stopped";
-      colorPair = 3;
+      state->status = "Stopped";
+      state->colorPair = 3;
     }
-    if (showHideLyrics == 0 && showOnlineRadio == 0) {
-      drawStatus(rows, cols, playlist, highlight, colorPair, status, offset, shuffle, repeat, volume, searchQuery, keys, showHideAlbum, showHideArtist, mp3Playlist);
+    if (!mp3Name.empty() && !vlcPlaying) {
+      trackName = mp3Name;
     }
-    else if (showOnlineRadio == 1) {
-      drawStatus(rows, cols, playlist2, highlight, colorPair, status, offset, shuffle, repeat, volume, searchQuery, keys, showHideAlbum, showHideArtist, m3uPlaylist);
-      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    if (vlcPlaying) {
+      std::lock_guard<std::mutex> lock(vlcMetaMutex);
+      trackName = vlcSongMeta;
     }
-    else {
-      drawLyrics(rows, cols, playlist);
-      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    if (trackName != layoutName) {
+      layoutName = trackName;
+      nameLayout = layoutText(trackName);
     }
-
-    // Show progress bar if playing
-    if (music.getStatus() != sf::Music::Stopped) {
-      float elapsed = music.getPlayingOffset().asSeconds();
-      float total = music.getDuration().asSeconds();
-      drawProgressBarWithTime(elapsed, total, cols - 20, rows - 2, 0);
+    state->trackName = trackName;
+    state->trackNameLayout = nameLayout;
+    state->track = nowPlaying;
+    state->hasTrack = hasNowPlaying;
+    state->searchQuery = searchQuery;
+    state->message = message;
+    state->highlight = highlight;
+    state->offset = offset;
+    state->shuffle = shuffle;
+    state->repeat = repeat;
+    state->volume = volume;
+    state->showHideAlbum = showHideAlbum;
+    state->showHideArtist = showHideArtist;
+    state->showHideLyrics = showHideLyrics;
+    state->showOnlineRadio = showOnlineRadio;
+    state->showStats = (showStats != 0);
+    state->focused = focused;
+    state->inputSeq = inputSeq;
+    state->inputStamp = inputStamp;
+    if (state->musicStatus != sf::SoundSource::Stopped) {
+      state->elapsed = music.position();
+      state->total = music.duration();
     }
-
-    wrefresh(stdscr);
-    choice = getch();
-    if (choice == keys["UP"]) {
-      if (showOnlineRadio == 0) {
-        highlight = (highlight - 1 + playlist.size()) % playlist.size();
+    state->stamp = std::chrono::steady_clock::now();
+    return std::shared_ptr<const PlayerState>(std::move(state));
+  };
+  // Lyrics for the next tracks in play order are fetched while the current one plays
+  auto prefetchLyrics = [&]() {
+    std::vector<Track> next;
+    if (currentTrack < 0 || currentTrack >= static_cast<int>(playlist.size()) || repeat) {
+      lyricsWorker.prefetch(std::move(next));
+      return;
+    }
+    int count = std::min(settings.lyricsPrefetch, static_cast<int>(playlist.size()) - 1);
+    if (shuffle) {
+      std::uniform_int_distribution<int> dist(0, static_cast<int>(playlist.size()) - 1);
+      while (static_cast<int>(shuffleOrder.size()) < count) {
+        shuffleOrder.push_back(dist(rng));
       }
-      else {
-        if (!playlist2.empty()) {
-          highlight = (highlight - 1 + playlist2.size()) % playlist2.size();
-        }
+      for (int i = 0; i < count; i++) {
+        next.push_back(playlist[shuffleOrder[i]]);
       }
     }
-    else if (choice == keys["DOWN"]) {
-      if (showOnlineRadio == 0) {
-        highlight = (highlight + 1) % playlist.size();
+    else {
+      for (int i = 1; i <= count; i++) {
+        next.push_back(playlist[(currentTrack + i) % playlist.size()]);
       }
-      else {
-        if (!playlist2.empty()) {
-          highlight = (highlight + 1) % playlist2.size();
-        }
+    }
+    lyricsWorker.prefetch(std::move(next));
+  };
+  // The track after the playing one: itself on repeat, the next one drawn on shuffle
+  auto followingTrack = [&]() {
+    if (repeat) {
+      return currentTrack;
+    }
+    if (shuffle) {
+      if (shuffleOrder.empty() || shuffleOrder.front() >= static_cast<int>(playlist.size())) {
+        std::uniform_int_distribution<int> dist(0, static_cast<int>(playlist.size()) - 1);
+        shuffleOrder.assign(1, dist(rng));
+      }
+      return shuffleOrder.front();
+    }
+    return (currentTrack + 1) % static_cast<int>(playlist.size());
+  };
+  // Open the following track now, so it starts on the sample after the playing one ends
+  auto queueNext = [&]() {
+    bool local = playingMp3 && currentTrack >= 0 && currentTrack < static_cast<int>(playlist.size());
+    music.queue(!local ? "" : repeat ? nowPlaying.path : playlist[followingTrack()].path);
+  };
+  // Where a file is in playlist, -1 when it is not there
+  auto findTrack = [&](const std::string &path) {
+    auto it = std::find_if(playlist.begin(), playlist.end(), [&](const Track &t) { return t.path == path; });
+    return (it != playlist.end()) ? static_cast<int>(it - playlist.begin()) : -1;
+  };
+  // After playlist was replaced: indices into the old one mean nothing, find the playing song
+  // again, or continue with the first track of the new list when it is not in there
+  auto relocateTrack = [&]() {
+    if (playingMp3 && hasNowPlaying) {
+      int at = findTrack(nowPlaying.path);
+      currentTrack = (at >= 0) ? at : static_cast<int>(playlist.size()) - 1;
+    }
+    queueNext();
+  };
+  playerState.store(snapshot());
+  // Resize and Ctrl+C must interrupt the control thread's poll(), so the render thread blocks them
+  sigset_t blocked, previous;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGWINCH);
+  sigaddset(&blocked, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+  std::thread renderThread(renderLoop);
+  httpClient.init();
+  lyricsStore.open(cacheDir(), settings.lyricsStoreBytes);
+  lyricsWorker.cache.setCapacity(settings.lyricsCacheBytes);
+  lyricsWorker.setPrefetchRate(settings.lyricsRate);
+  lyricsWorker.start();
+  seekIndexer.start(cacheDir() + "/seek", settings.seekIndexBytes);
+  music.setCrossfade(settings.crossfade, settings.crossfadeCurve);
+  music.setBufferLength(settings.audioBufferMs);
+  music.setReadAhead(settings.audioReadAheadMs);
+  std::thread indexer(indexStoredLyrics, mp3Playlist);
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  // Modal one line prompt at the bottom, the render thread waits on the screen until it is done
+  auto prompt = [](const char *label) {
+    char buf[256] = {'\0'};
+    std::lock_guard<std::mutex> lock(screenMutex);
+    int rows = getmaxy(stdscr);
+    nodelay(stdscr, FALSE);
+    echo();
+    curs_set(1);
+    mvprintw(rows - 3, 0, "%s", label);
+    getnstr(buf, 255);
+    noecho();
+    curs_set(0);
+    nodelay(stdscr, TRUE);
+    return std::string(buf);
+  };
+
+  while (running) {
+    // Wait for input without holding the screen, drawing never delays a keypress.
+    // Nothing needs a timer unless a track can end or the radio title can change.
+    int timeoutMs = -1;
+    if (music.getStatus() == sf::SoundSource::Playing) {
+      float remaining = music.duration() - music.position();
+      timeoutMs = std::clamp(static_cast<int>(remaining * 1000.f) + 5, 5, 1000);
+    }
+    else if (vlcPlaying) {
+      timeoutMs = 1000;
+    }
+    struct pollfd pfds[2] = {{STDIN_FILENO, POLLIN, 0}, {controlWakeFds[0], POLLIN, 0}};
+    poll(pfds, (controlWakeFds[0] >= 0) ? 2 : 1, timeoutMs);
+    if (pfds[1].revents & POLLIN) {
+      char drain[64];
+      while (read(controlWakeFds[0], drain, sizeof(drain)) > 0) {
       }
     }
-    else if (choice == keys["PLAY"] || choice == keys["NEXT_SONG"] || choice == keys["PREVIOUS_SONG"]) {
-      if (player) {
-        libvlc_media_player_stop(player);
-        libvlc_media_player_release(player);
+    for (bool first = true;; first = false) {
+      {
+        std::lock_guard<std::mutex> lock(screenMutex);
+        choice = getch();
+      }
+      if (choice == ERR) {
+        break;
+      }
+      if (first) {
+        inputSeq++;
+        inputStamp = std::chrono::steady_clock::now();
       }
-      if (showOnlineRadio == 0) {
-        if (choice == keys["PREVIOUS_SONG"]) {
+      message.clear();
+      if (choice == keys["UP"]) {
+        if (showOnlineRadio == 0) {
           highlight = (highlight - 1 + playlist.size()) % playlist.size();
         }
-        else if (choice == keys["NEXT_SONG"]) {
-          highlight = (highlight + 1 + playlist.size()) % playlist.size();
+        else {
+          if (!playlist2.empty()) {
+            highlight = (highlight - 1 + playlist2.size()) % playlist2.size();
+          }
+        }
+      }
+      else if (choice == keys["DOWN"]) {
+        if (showOnlineRadio == 0) {
+          highlight = (highlight + 1) % playlist.size();
         }
-        if (!music.openFromFile(playlist[highlight].path)) {
-          mvprintw(rows - 1, 0, "Error: Cannot play file.");
-        } else {
-          music.setVolume(volume);
-          music.play();
+        else {
+          if (!playlist2.empty()) {
+            highlight = (highlight + 1) % playlist2.size();
+          }
         }
-        currentTrack = highlight;
-        vlcPlaying = false;
-        playingMp3 = true;
-        mp3Name = playlist[currentTrack].title;
       }
-      else {
-        if (!playlist2.empty()) {
+      else if (choice == keys["PLAY"] || choice == keys["NEXT_SONG"] || choice == keys["PREVIOUS_SONG"]) {
+        if (player) {
+          libvlc_media_player_stop(player);
+          libvlc_media_player_release(player);
+        }
+        if (showOnlineRadio == 0) {
           if (choice == keys["PREVIOUS_SONG"]) {
-            highlight = (highlight - 1 + playlist2.size()) % playlist2.size();
+            highlight = (highlight - 1 + playlist.size()) % playlist.size();
           }
           else if (choice == keys["NEXT_SONG"]) {
-            highlight = (highlight + 1 + playlist2.size()) % playlist2.size();
+            highlight = (highlight + 1 + playlist.size()) % playlist.size();
+          }
+          // Skipping while a local song plays fades into the new one, PLAY cuts straight to it
+          bool jump = highlight < static_cast<int>(lyricsJumps.size());
+          bool faded = choice != keys["PLAY"] && !jump && music.fadeTo(playlist[highlight].path);
+          if (!faded && !music.open(playlist[highlight].path)) {
+            message = "Error: Cannot play file.";
+          } else if (!faded) {
+            music.setVolume(volume);
+            if (jump) {
+              music.seek(lyricsJumps[highlight]);
+            }
           }
-          media = libvlc_media_new_location(vlc, parsedM3u[highlight].c_str());
-          // Attach event listener for metadata changes
-          libvlc_event_manager_t *eventManager = libvlc_media_event_manager(media);
-          libvlc_event_attach(eventManager, libvlc_MediaMetaChanged, handle_event, media);
-          player = libvlc_media_player_new_from_media(media);
-          libvlc_media_release(media);
-          libvlc_media_player_play(player);
-          vlcPlaying = true;
-          playingMp3 = false;
           currentTrack = highlight;
-          if (music.getStatus() == sf::Music::Playing) {
-            music.pause();
+          vlcPlaying = false;
+          playingMp3 = true;
+          mp3Name = playlist[currentTrack].title;
+          nowPlaying = playlist[currentTrack];
+          hasNowPlaying = true;
+          lyricsWorker.request(nowPlaying); // parsed once, ready before the lyrics view asks
+          prefetchLyrics();
+          queueNext();
+        }
+        else {
+          if (!playlist2.empty()) {
+            if (choice == keys["PREVIOUS_SONG"]) {
+              highlight = (highlight - 1 + playlist2.size()) % playlist2.size();
+            }
+            else if (choice == keys["NEXT_SONG"]) {
+              highlight = (highlight + 1 + playlist2.size()) % playlist2.size();
+            }
+            media = libvlc_media_new_location(vlc, parsedM3u[highlight].c_str());
+            // Attach event listener for metadata changes
+            libvlc_event_manager_t *eventManager = libvlc_media_event_manager(media);
+            libvlc_event_attach(eventManager, libvlc_MediaMetaChanged, handle_event, media);
+            player = libvlc_media_player_new_from_media(media);
+            libvlc_media_release(media);
+            libvlc_media_player_play(player);
+            vlcPlaying = true;
+            playingMp3 = false;
+            currentTrack = highlight;
+            if (music.getStatus() == sf::SoundSource::Playing) {
+              music.pause();
+            }
           }
         }
       }
-    }
-    else if (choice == keys["PAUSE"]) {
-      if (vlcPlaying) {
-        libvlc_media_player_stop(player);
-        libvlc_media_player_release(player);
-        vlcPlaying = false;
+      else if (choice == keys["PAUSE"]) {
+        if (vlcPlaying) {
+          libvlc_media_player_stop(player);
+          libvlc_media_player_release(player);
+          vlcPlaying = false;
+        }
+        if (music.getStatus() == sf::SoundSource::Playing) {
+          music.pause();
+        }
+        else if (music.getStatus() == sf::SoundSource::Paused && !vlcPlaying) {
+          music.play();
+        }
       }
-      if (music.getStatus() == sf::Music::Playing) {
-        music.pause();
+      else if (choice == keys["VOLUMEUP"] || choice == keys["VOLUMEDOWN"]) {
+        volume = (choice == keys["VOLUMEUP"]) ? std::min(100.f, volume + 5.f) : std::max(0.f, volume - 5.f);
+        if (showOnlineRadio == 0) {
+          music.setVolume(volume);
+        }
+        else {
+          if (player) {
+            libvlc_audio_set_volume(player, volume);
+          }
+        }
       }
-      else if (music.getStatus() == sf::Music::Paused && !vlcPlaying) {
-        music.play();
+      else if (choice == keys["SHUFFLE"]) {
+        shuffle = !shuffle;
+        shuffleOrder.clear();
+        prefetchLyrics();
+        queueNext();
       }
-    }
-    else if (choice == keys["VOLUMEUP"] || choice == keys["VOLUMEDOWN"]) {
-      volume = (choice == keys["VOLUMEUP"]) ? std::min(100.f, volume + 5.f) : std::max(0.f, volume - 5.f);
-      if (showOnlineRadio == 0) {
-        music.setVolume(volume);
+      else if (choice == keys["REPEAT"]) {
+        repeat = !repeat;
+        prefetchLyrics();
+        queueNext();
       }
-      else {
-        if (player) {
-          libvlc_audio_set_volume(player, volume);
+      else if (choice == keys["SHOW_HIDE_ALBUM"]) {
+        showHideAlbum = !showHideAlbum;
+      }
+      else if (choice == keys["SHOW_HIDE_ARTIST"]) {
+        showHideArtist = !showHideArtist;
+      }
+      else if (choice == keys["SHOW_HIDE_LYRICS"]) {
+        showHideLyrics = !showHideLyrics;
+      }
+      else if (choice == keys["SHOW_HIDE_STATS"]) {
+        showStats = !showStats;
+        collectStats = (showStats != 0 || printStats);
+      }
+      else if (choice == keys["SHOW_HIDE_ONLINE_RADIO"]) {
+        showOnlineRadio = !showOnlineRadio;
+        if (vlcPlaying) {
+          music.pause();
+        }
+        if (!playlist2.empty()) {
+          highlight = (highlight + playlist2.size()) % playlist2.size();
         }
       }
-    }
-    else if (choice == keys["SHUFFLE"]) {
-      shuffle = !shuffle;
-    }
-    else if (choice == keys["REPEAT"]) {
-      repeat = !repeat;
-    }
-    else if (choice == keys["SHOW_HIDE_ALBUM"]) {
-      showHideAlbum = !showHideAlbum;
-    }
-    else if (choice == keys["SHOW_HIDE_ARTIST"]) {
-      showHideArtist = !showHideArtist;
-    }
-    else if (choice == keys["SHOW_HIDE_LYRICS"]) {
-      showHideLyrics = !showHideLyrics;
-    }
-    else if (choice == keys["SHOW_HIDE_ONLINE_RADIO"]) {
-      showOnlineRadio = !showOnlineRadio;
-      if (vlcPlaying) {
-        music.pause();
+      else if (choice == keys["SEARCH"]) {
+        searchQuery = prompt("Search: ");
+        // Filter playlist
+        if (showOnlineRadio == 0) {
+          playlist.clear();
+          auto allFiles = listAudioFiles(musicDir);
+          playlist = filterTracks(allFiles, searchQuery);
+          sharedPlaylist = std::make_shared<const std::vector<Track>>(playlist);
+          shuffleOrder.clear(); // indices into the old list
+          lyricsJumps.clear();
+          relocateTrack();
+        }
+        else {
+          if (!radioDir.empty()) {
+            playlist2.clear();
+            auto allFiles = listM3uFiles(radioDir);
+            playlist2 = filterTracks(allFiles, searchQuery);
+            sharedPlaylist2 = std::make_shared<const std::vector<Track>>(playlist2);
+          }
+        }
+        highlight = 0;
+        offset = 0;
       }
-      if (!playlist2.empty()) {
-        highlight = (highlight + playlist2.size()) % playlist2.size();
+      else if (choice == keys["SEARCH_LYRICS"] && showOnlineRadio == 0) {
+        // Songs whose lyrics contain the phrase, each starts at the matching line when played
+        std::string query = prompt("Lyrics: ");
+        std::vector<Track> found;
+        std::vector<float> jumps;
+        if (query.empty()) {
+          found = mp3Playlist;
+        }
+        else {
+          std::unordered_map<uint64_t, const Track *> library;
+          for (auto &t : mp3Playlist) {
+            library[trackId(t)] = &t;
+          }
+          for (auto &hit : lyricsIndex.search(query, 500)) {
+            auto it = library.find(hit.id);
+            if (it != library.end()) {
+              found.push_back(*it->second);
+              found.back().duration += " @ " + formatTime(hit.time);
+              jumps.push_back(hit.time);
+            }
+          }
+        }
+        if (found.empty()) {
+          message = "No lyrics contain \"" + query + "\", " + std::to_string(lyricsIndex.songs()) + " songs searched.";
+        }
+        else {
+          playlist = std::move(found);
+          lyricsJumps = std::move(jumps);
+          searchQuery = query.empty() ? "" : "lyrics \"" + query + "\"";
+          sharedPlaylist = std::make_shared<const std::vector<Track>>(playlist);
+          shuffleOrder.clear();
+          relocateTrack();
+          highlight = 0;
+          offset = 0;
+        }
       }
-    }
-    else if (choice == keys["SEARCH"]) {
-      echo();
-      curs_set(1);
-      char buf[256] = {'\0'};
-      mvprintw(rows - 3, 0, "Search: ");
-      getnstr(buf, 255);
-      searchQuery = buf;
-      // Filter playlist
-      if (showOnlineRadio == 0) {
-        playlist.clear();
-        auto allFiles = listAudioFiles(musicDir);
-        playlist = filterTracks(allFiles, searchQuery);
+      else if (choice == keys["SEEKLEFT"]) {
+        if (music.getStatus() != sf::SoundSource::Stopped) {
+          float newPos = music.position() - 5.0f;
+          if (newPos < 0) newPos = 0;
+          music.seek(newPos);
+        }
       }
-      else {
-        if (argc > 2) {
-          playlist2.clear();
-          auto allFiles = listM3uFiles(argv[2]);
-          playlist2 = filterTracks(allFiles, searchQuery);
+      else if (choice == keys["SEEKRIGHT"]) {
+        if (music.getStatus() != sf::SoundSource::Stopped) {
+          float newPos = music.position() + 5.0f;
+          if (newPos > music.duration())
+            newPos = music.duration();
+          music.seek(newPos);
         }
       }
-      highlight = 0;
-      offset = 0;
-      noecho();
-      curs_set(0);
-    }
-    else if (choice == keys["SEEKLEFT"]) {
-      if (music.getStatus() != sf::Music::Stopped) {
-        float newPos = music.getPlayingOffset().asSeconds() - 5.0f;
-        if (newPos < 0) newPos = 0;
-        music.setPlayingOffset(sf::seconds(newPos));
+      else if (choice == keys["QUIT"]) {
+        running = false;
       }
-    }
-    else if (choice == keys["SEEKRIGHT"]) {
-      if (music.getStatus() != sf::Music::Stopped) {
-        float newPos = music.getPlayingOffset().asSeconds() + 5.0f;
-        if (newPos > music.getDuration().asSeconds())
-          newPos = music.getDuration().asSeconds();
-        music.setPlayingOffset(sf::seconds(newPos));
+      else if (choice == KEY_FOCUS_IN || choice == KEY_FOCUS_OUT) {
+        focused = (choice == KEY_FOCUS_IN);
       }
     }
-    else if (choice == keys["QUIT"]) {
-      running = false;
+    // The queued track took over without a gap, catch the UI up with the file actually heard
+    std::string heard;
+    if (music.advanced(heard)) {
+      int at = findTrack(heard);
+      if (at >= 0) {
+        if (shuffle && !repeat && !shuffleOrder.empty() && shuffleOrder.front() == at) {
+          shuffleOrder.pop_front();
+        }
+        currentTrack = highlight = at;
+        nowPlaying = playlist[at];
+      }
+      else {
+        // Queued before a search left it out of the list
+        auto it = std::find_if(mp3Playlist.begin(), mp3Playlist.end(), [&](const Track &t) { return t.path == heard; });
+        if (it != mp3Playlist.end()) {
+          nowPlaying = *it;
+        }
+        else {
+          nowPlaying = Track();
+          nowPlaying.path = heard;
+          nowPlaying.title = std::filesystem::path(heard).filename().string();
+        }
+        currentTrack = static_cast<int>(playlist.size()) - 1;
+      }
+      mp3Name = nowPlaying.title;
+      lyricsWorker.request(nowPlaying);
+      prefetchLyrics();
+      queueNext();
     }
-    // Auto-play next track
-    if (music.getStatus() == sf::Music::Stopped && currentTrack != -1) {
+    // Auto-play next track, when it could not be joined to the last one
+    if (music.getStatus() == sf::SoundSource::Stopped && currentTrack != -1) {
       if (showOnlineRadio == 0 && !vlcPlaying) {
         if (repeat) {
           music.play();
         } else {
+          // Take the track whose lyrics were prefetched, if the shuffle order was drawn already
+          highlight = followingTrack();
           if (shuffle) {
-            static std::mt19937 rng(std::random_device{}());
-            std::uniform_int_distribution<int> dist(0, playlist.size() - 1);
-            highlight = dist(rng);
-          } else {
-            highlight = (highlight + 1 + playlist.size()) % playlist.size();
+            shuffleOrder.pop_front();
           }
-          if (!music.openFromFile(playlist[highlight].path)) {
-            mvprintw(rows - 1, 0, "Error: Cannot play file.");
+          if (!music.open(playlist[highlight].path)) {
+            message = "Error: Cannot play file.";
           } else {
             music.setVolume(volume);
-            music.play();
-            currentTrack = highlight;
           }
+          currentTrack = highlight; // a file that fails is skipped next time
+          mp3Name = playlist[currentTrack].title;
+          nowPlaying = playlist[currentTrack];
         }
-        mp3Name = playlist[currentTrack].title;
+        hasNowPlaying = true;
+        lyricsWorker.request(nowPlaying);
+        prefetchLyrics();
         playingMp3 = true;
         vlcPlaying = false;
+        queueNext();
       }
       else {
         if (!playingMp3 && player && vlcPlaying) {
@@ -388,6 +1332,28 @@ int main(int argc, char *argv[]) {
         }
       }
     }
+    // Radio metadata arrives on the libvlc thread, fold it into the list here
+    if (vlcMetaChanged.exchange(false) && currentTrack >= 0 && currentTrack < static_cast<int>(playlist2.size())) {
+      std::lock_guard<std::mutex> lock(vlcMetaMutex);
+      playlist2[currentTrack].title = vlcSongMeta;
+      playlist2[currentTrack].titleLayout = layoutText(vlcSongMeta);
+      sharedPlaylist2 = std::make_shared<const std::vector<Track>>(playlist2);
+    }
+    publishState(snapshot());
+  }
+  publishState(snapshot());
+  renderThread.join();
+  lyricsWorker.stop();
+  seekIndexer.stop();
+  indexer.join();
+  lyricsStore.close();
+  httpClient.cleanup();
+  fputs("\033[?1004l", stdout);
+  fflush(stdout);
+  for (int fd : controlWakeFds) {
+    if (fd >= 0) {
+      close(fd);
+    }
   }
   if (player) {
     libvlc_media_player_stop(player);
@@ -396,245 +1362,2726 @@ int main(int argc, char *argv[]) {
   libvlc_release(vlc);
   // Cleanup ncurses
   endwin();
-  return EXIT_SUCCESS;
-}
-
-// Event callback for metadata changes
-static void handle_event(const libvlc_event_t *event, void *user_data) {
-  if (event->type == libvlc_MediaMetaChanged) {
-    libvlc_media_t *media2 = static_cast<libvlc_media_t *>(user_data);
-    //const char *title = libvlc_media_get_meta(media2, libvlc_meta_Title);
-    //const char *title2 = libvlc_media_get_meta(media2, libvlc_meta_Artist);
-    //const char *title3 = libvlc_media_get_meta(media2, libvlc_meta_Album);
-    char *title4 = libvlc_media_get_meta(media2, libvlc_meta_NowPlaying);
-    if (title4) {
-      vlcSongMeta = title4;
-      playlist2[currentTrack].title = title4;
-      libvlc_free(title4);
-    }
+  if (printStats) {
+    dumpStats(std::cout);
   }
+  return EXIT_SUCCESS;
 }
 
-// Signal handler for Ctrl+C
-void signal_handler(int) {
-  running = false;
+// Publish a new snapshot and wake the render thread
+void publishState(std::shared_ptr<const PlayerState> state) {
+  playerState.store(std::move(state));
+  wakeRender();
 }
 
-// Trim whitespace
-static inline std::string trim(const std::string &s) {
-  auto start = s.find_first_not_of(" \t\r\n");
-  auto end = s.find_last_not_of(" \t\r\n");
-  return (start == std::string::npos) ? "" : s.substr(start, end - start + 1);
+// Wake the render thread without a new snapshot
+void wakeRender() {
+  {
+    std::lock_guard<std::mutex> lock(renderWakeMutex);
+    renderPending = true;
+  }
+  renderWake.notify_one();
 }
 
-// Parse .m3u playlist
-std::vector<std::string> parseM3U(const std::vector<std::string> &filename) {
-  std::vector<std::string> urls;
-  for (auto &x : filename) {
-    std::ifstream file(x);
-    if (!file) {
-      return urls;
+// Render thread loop, draws the latest snapshot and never touches the player itself
+void renderLoop() {
+  uint64_t drawnInputSeq = 0;
+  uint64_t windowFrames = 0;
+  uint64_t windowBytes = 0;
+  auto windowStart = std::chrono::steady_clock::now();
+  while (running) {
+    std::shared_ptr<const PlayerState> state = playerState.load();
+    std::shared_ptr<const LyricsResult> lyrics;
+    bool lyricsView = (state->showHideLyrics != 0 && state->showOnlineRadio == 0);
+    if (lyricsView && state->hasTrack && state->musicStatus == sf::SoundSource::Playing) {
+      lyrics = lyricsWorker.result(state->track);
+      if (!lyrics) {
+        lyricsWorker.request(state->track);
+      }
     }
-    std::string line;
-    while (std::getline(file, line)) {
-      line = trim(line);
-      if (line.empty() || line[0] == '#') continue;
-      urls.push_back(line);
+    {
+      std::lock_guard<std::mutex> lock(screenMutex);
+      bool sample = collectStats;
+      uint64_t bytesBefore = sample ? threadBytesWritten() : 0;
+      auto start = std::chrono::steady_clock::now();
+      drawFrame(*state, lyrics.get());
+      auto end = std::chrono::steady_clock::now();
+      stats.draw.record(end - start);
+      if (sample) {
+        uint64_t written = threadBytesWritten() - bytesBefore;
+        stats.bytes += written;
+        windowBytes += written;
+      }
+      if (state->inputSeq != drawnInputSeq) {
+        drawnInputSeq = state->inputSeq;
+        stats.input.record(end - state->inputStamp);
+      }
+      stats.frames++;
+      windowFrames++;
+      float window = std::chrono::duration<float>(end - windowStart).count();
+      if (window >= 1.f) {
+        stats.fps = static_cast<float>(windowFrames) / window;
+        stats.bytesPerSecond = static_cast<float>(windowBytes) / window;
+        windowFrames = 0;
+        windowBytes = 0;
+        windowStart = end;
+      }
     }
+    // Sleep until the screen would change on its own, a published snapshot wakes us early
+    auto interval = frameInterval(*state);
+    std::unique_lock<std::mutex> lock(renderWakeMutex);
+    if (interval.count() < 0) {
+      renderWake.wait(lock, [] { return renderPending || !running; });
+    }
+    else {
+      renderWake.wait_for(lock, interval, [] { return renderPending || !running; });
+    }
+    renderPending = false;
   }
-  return urls;
 }
 
-// Function to draw the lyrics
-void drawLyrics(int rows, int cols, std::vector<Track> playlist) {
-  if (music.getStatus() != sf::Music::Playing) {
-    return;
+// How long the screen stays valid for a snapshot, negative when only a new snapshot changes it
+std::chrono::milliseconds frameInterval(const PlayerState &state) {
+  bool playing = (state.musicStatus == sf::SoundSource::Playing);
+  if (!state.focused || (!playing && !state.showStats)) {
+    return std::chrono::milliseconds(-1);
   }
-  std::string apiUrl = "https://lrclib.net/api/get?artist_name=" + playlist[currentTrack].artist + "&track_name=" + playlist[currentTrack].title;
-  std::string api2 = std::regex_replace(apiUrl, std::regex(" "), "%20");
-  std::string curLyrFile = std::regex_replace(playlist[currentTrack].path, std::regex(" "), "_") + static_cast<std::string>(".lrc");
-  if (!std::filesystem::exists(curLyrFile)) {
-    if (!fetchLyricsToFile(api2, curLyrFile)) {
-      attron(COLOR_PAIR(3) | A_BOLD);
-      printw("Can't find lyrics for this song. Switch back to the menu with the songs.");
-      attroff(COLOR_PAIR(3) | A_BOLD);
-      return;
-    }
+  if (playing && state.showHideLyrics != 0 && state.showOnlineRadio == 0) {
+    return std::chrono::milliseconds(1000 / std::clamp(settings.lyricsFps, 30, 60));
   }
-  std::ifstream f(curLyrFile);
-  json data = json::parse(f);
-  std::string songLrc = data["syncedLyrics"];
-  f.close();
-  std::ofstream outFile;
-  outFile.open("/tmp/.song2.lrc", std::ios::out);
-  if (!outFile) {
+  if (playing) {
+    // The progress bar and the mm:ss labels only move once per second of the track
+    float offset = snapshotOffset(state);
+    return std::chrono::milliseconds(static_cast<int>((1.f - (offset - std::floor(offset))) * 1000.f) + 1);
+  }
+  return std::chrono::milliseconds(1000); // stats overlay
+}
+
+// Wake the control thread from another thread
+void wakeControl() {
+  if (controlWakeFds[1] >= 0) {
+    char byte = 1;
+    ssize_t ignored = write(controlWakeFds[1], &byte, 1);
+    (void)ignored;
+  }
+}
+
+// Playing offset of a snapshot, extrapolated to now
+float snapshotOffset(const PlayerState &state) {
+  if (state.musicStatus != sf::SoundSource::Playing) {
+    return state.elapsed;
+  }
+  float since = std::chrono::duration<float>(std::chrono::steady_clock::now() - state.stamp).count();
+  return std::min(state.elapsed + since, state.total);
+}
+
+// Draw one whole frame from a snapshot
+void drawFrame(const PlayerState &state, const LyricsResult *lyrics) {
+  werase(stdscr);
+  int rows, cols;
+  getmaxyx(stdscr, rows, cols);
+  if (state.showHideLyrics == 0 || state.showOnlineRadio == 1) {
+    drawStatus(rows, cols, state);
+  }
+  else {
+    drawLyrics(rows, cols, state, lyrics);
+  }
+
+  // Show progress bar if playing
+  if (state.musicStatus != sf::SoundSource::Stopped) {
+    drawProgressBarWithTime(snapshotOffset(state), state.total, cols - 20, rows - 2, 0);
+  }
+  if (!state.message.empty()) {
+    mvprintw(rows - 1, 0, "%s", state.message.c_str());
+  }
+  if (state.showStats) {
+    drawStatsOverlay(rows, cols);
+  }
+  wrefresh(stdscr);
+}
+
+// Draw the frame time/latency overlay in the top right corner
+void drawStatsOverlay(int rows, int cols) {
+  std::vector<StatsLine> lines = playerStatsLines();
+  int width = 44;
+  int x = (cols > width) ? cols - width : 0;
+  if (static_cast<size_t>(std::max(rows, 0)) < lines.size() + 5) {
     return;
   }
-  outFile << songLrc;
-  outFile.close();
-  auto lyrics = loadLyrics("/tmp/.song2.lrc");
-  float currentTime = music.getPlayingOffset().asSeconds();
-  float duration = music.getDuration().asSeconds();
-  //float progress = currentTime / duration;
+  attron(A_REVERSE);
+  mvprintw(2, x, " %5.1f fps %8.0f B/s %10llu frames ", static_cast<double>(stats.fps.load()), static_cast<double>(stats.bytesPerSecond.load()), static_cast<unsigned long long>(stats.frames.load()));
+  mvprintw(3, x, " %-8s %8s %8s %8s %6s ", "ms", "p50", "p99", "max", "n");
+  for (size_t i = 0; i < lines.size(); i++) {
+    const Histogram &hist = *lines[i].hist;
+    uint64_t n = hist.total;
+    mvprintw(4 + static_cast<int>(i), x, " %-8s %8.2f %8.2f %8.2f %6llu ", lines[i].name, static_cast<double>(hist.percentile(0.50)), static_cast<double>(hist.percentile(0.99)), static_cast<double>(hist.max.load()) / 1000.0, static_cast<unsigned long long>(std::min<uint64_t>(n, 999999)));
+  }
+  mvprintw(4 + static_cast<int>(lines.size()), x, " %-8s %6.1f%% full %10llu underruns ", "ring", static_cast<double>(music.fill()) * 100.0, static_cast<unsigned long long>(music.underruns()));
+  attroff(A_REVERSE);
+}
+
+// Print the collected stats, used by --stats on exit
+void dumpStats(std::ostream &out) {
+  float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - stats.started).count();
+  uint64_t frames = stats.frames;
+  out << "frames: " << frames << " in " << std::fixed << std::setprecision(1) << seconds << "s (" << ((seconds > 0.f) ? static_cast<float>(frames) / seconds : 0.f) << " fps avg)\n";
+  out << "terminal bytes: " << stats.bytes << " (" << ((frames > 0) ? stats.bytes / frames : 0) << " per frame)\n";
+  out << "audio underruns: " << music.underruns() << "\n";
+  printStatsTable(out, playerStatsLines());
+}
+
+// The player's histograms, in the order the overlay and --stats list them
+std::vector<StatsLine> playerStatsLines() {
+  return {
+    {"draw", &stats.draw}, {"input", &stats.input}, {"lyrics", &stats.lyrics}, {"metadata", &stats.metadata}, {"decode", &stats.decode}, {"seek", &stats.seek},
+  };
+}
 
-  // Find current line index
-  while (currentLine + 1 < lyrics.size() && currentTime >= lyrics[currentLine + 1].time) {
-    currentLine++;
+// Print histograms as a table of count, p50, p99 and max in milliseconds
+void printStatsTable(std::ostream &out, const std::vector<StatsLine> &lines) {
+  out << std::left << std::setw(10) << "ms" << std::right << std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+  out << std::fixed << std::setprecision(3);
+  for (auto &line : lines) {
+    out << std::left << std::setw(10) << line.name << std::right << std::setw(10) << line.hist->total << std::setw(10) << line.hist->percentile(0.50) << std::setw(10) << line.hist->percentile(0.99) << std::setw(10) << static_cast<double>(line.hist->max.load()) / 1000.0 << "\n";
   }
-  // Calculate smooth scroll offset
-  float lineStartTime = lyrics[currentLine].time;
-  float lineEndTime = (currentLine + 1 < lyrics.size()) ? lyrics[currentLine + 1].time : duration;
-  float lineDuration = lineEndTime - lineStartTime;
-  float elapsedInLine = currentTime - lineStartTime;
-  float scrollOffset = (elapsedInLine / lineDuration) * 1.0f; // 1.0 = one line height
-  // Draw lyrics with fractional offset
-  int centerY = rows / 2;
-  for (int i = -3; i <= 3; i++) {
-    int idx = static_cast<int>(currentLine) + i;
-    if (idx >= 0 && idx < static_cast<int>(lyrics.size())) {
-      int yPos = centerY + static_cast<int>(((i - scrollOffset) * 2)); // 2 = line spacing
-      if (yPos >= 0 && yPos < rows - 3) {
-        if (i == 0) attron(A_BOLD | A_STANDOUT);
-        mvprintw(yPos, (cols - lyrics[idx].text.size()) / 2, "%s", lyrics[idx].text.c_str());
-        if (i == 0) attroff(A_BOLD | A_STANDOUT);
+}
+
+// Bucket index of a value in microseconds, 4 linear steps per power of two
+static int histogramBucket(uint64_t us) {
+  if (us < 4) {
+    return static_cast<int>(us);
+  }
+  int log = static_cast<int>(std::bit_width(us)) - 1;
+  int idx = (log - 1) * 4 + static_cast<int>((us >> (log - 2)) & 3);
+  return std::min(idx, Histogram::buckets - 1);
+}
+
+// Upper bound of a bucket in microseconds
+static uint64_t histogramBucketLimit(int idx) {
+  if (idx < 4) {
+    return static_cast<uint64_t>(idx) + 1;
+  }
+  int log = idx / 4 + 1;
+  return (5ULL + static_cast<uint64_t>(idx % 4)) << (log - 2);
+}
+
+void Histogram::record(std::chrono::steady_clock::duration d) {
+  uint64_t us = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+  counts[histogramBucket(us)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  uint64_t prev = max.load(std::memory_order_relaxed);
+  while (us > prev && !max.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {
+  }
+}
+
+float Histogram::percentile(double p) const {
+  uint64_t n = total.load(std::memory_order_relaxed);
+  if (n == 0) {
+    return 0.f;
+  }
+  uint64_t want = static_cast<uint64_t>(std::ceil(p * static_cast<double>(n)));
+  uint64_t seen = 0;
+  for (int i = 0; i < buckets; i++) {
+    seen += counts[i].load(std::memory_order_relaxed);
+    if (seen >= want) {
+      return static_cast<float>(std::min(histogramBucketLimit(i), max.load(std::memory_order_relaxed))) / 1000.f;
+    }
+  }
+  return static_cast<float>(max.load(std::memory_order_relaxed)) / 1000.f;
+}
+
+// Bytes written so far by the calling thread, from /proc/thread-self/io
+uint64_t threadBytesWritten() {
+  thread_local int fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+  char buf[512] = {'\0'};
+  if (fd < 0 || pread(fd, buf, sizeof(buf) - 1, 0) <= 0) {
+    return 0;
+  }
+  const char *wchar = strstr(buf, "wchar:");
+  return wchar ? std::strtoull(wchar + 6, nullptr, 10) : 0;
+}
+
+// Curses setup shared by the player and the UI benchmark
+void setupScreen() {
+  start_color();
+  use_default_colors();
+  init_pair(1, COLOR_GREEN, -1); // Playing
+  init_pair(2, COLOR_YELLOW, -1); // Paused
+  init_pair(3, COLOR_RED, -1); // Stopped
+  noecho();
+  cbreak();
+  keypad(stdscr, TRUE);
+  curs_set(0);
+  nodelay(stdscr, TRUE); // Input waits in poll(), getch only drains what is there
+}
+
+// Apply one scripted key to the benchmark's fake player, there is no audio behind it
+static void applyBenchKey(PlayerState &state, int key, const std::unordered_map<std::string, int> &keys, const std::shared_ptr<const std::vector<Track>> &tracks, const std::shared_ptr<const std::vector<Track>> &radio) {
+  int size = static_cast<int>(state.playlist->size());
+  if (key == keys.at("UP")) {
+    state.highlight = (state.highlight - 1 + size) % size;
+  }
+  else if (key == keys.at("DOWN")) {
+    state.highlight = (state.highlight + 1) % size;
+  }
+  else if (key == keys.at("PLAY") || key == keys.at("NEXT_SONG") || key == keys.at("PREVIOUS_SONG")) {
+    if (key == keys.at("NEXT_SONG")) state.highlight = (state.highlight + 1) % size;
+    if (key == keys.at("PREVIOUS_SONG")) state.highlight = (state.highlight - 1 + size) % size;
+    state.track = (*state.playlist)[state.highlight];
+    state.hasTrack = true;
+    state.trackName = state.track.title;
+    state.trackNameLayout = state.track.titleLayout;
+    state.musicStatus = sf::SoundSource::Playing;
+    state.status = "Playing";
+    state.colorPair = 1;
+    state.elapsed = 0.f;
+    state.total = 240.f;
+  }
+  else if (key == keys.at("PAUSE")) {
+    bool playing = (state.musicStatus == sf::SoundSource::Playing);
+    state.musicStatus = playing ? sf::SoundSource::Paused : sf::SoundSource::Playing;
+    state.status = playing ? "Paused" : "Playing";
+    state.colorPair = playing ? 2 : 1;
+  }
+  else if (key == keys.at("SEEKLEFT")) {
+    state.elapsed = std::max(0.f, state.elapsed - 5.f);
+  }
+  else if (key == keys.at("SEEKRIGHT")) {
+    state.elapsed = std::min(state.total, state.elapsed + 5.f);
+  }
+  else if (key == keys.at("VOLUMEUP") || key == keys.at("VOLUMEDOWN")) {
+    state.volume = (key == keys.at("VOLUMEUP")) ? std::min(100.f, state.volume + 5.f) : std::max(0.f, state.volume - 5.f);
+  }
+  else if (key == keys.at("SHUFFLE")) {
+    state.shuffle = !state.shuffle;
+  }
+  else if (key == keys.at("REPEAT")) {
+    state.repeat = !state.repeat;
+  }
+  else if (key == keys.at("SHOW_HIDE_ALBUM")) {
+    state.showHideAlbum = !state.showHideAlbum;
+  }
+  else if (key == keys.at("SHOW_HIDE_ARTIST")) {
+    state.showHideArtist = !state.showHideArtist;
+  }
+  else if (key == keys.at("SHOW_HIDE_LYRICS")) {
+    state.showHideLyrics = !state.showHideLyrics;
+  }
+  else if (key == keys.at("SHOW_HIDE_STATS")) {
+    state.showStats = !state.showStats;
+  }
+  else if (key == keys.at("SHOW_HIDE_ONLINE_RADIO")) {
+    state.showOnlineRadio = !state.showOnlineRadio;
+    state.playlist = state.showOnlineRadio ? radio : tracks;
+    state.highlight = 0;
+  }
+}
+
+// Headless UI benchmark: replay a key script against a synthetic library, drawing into a pty
+int runUiBenchmark(const std::string &script, int trackCount, int framesPerKey) {
+  int master = -1;
+  int slave = -1;
+  struct winsize size = {};
+  size.ws_row = 40;
+  size.ws_col = 120;
+  if (openpty(&master, &slave, nullptr, nullptr, &size) != 0) {
+    std::cerr << "Cannot open a pty for the benchmark: " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+  FILE *out = fdopen(slave, "w");
+  FILE *in = fdopen(dup(slave), "r");
+  SCREEN *screen = (out && in) ? newterm("xterm", out, in) : nullptr;
+  if (!screen) {
+    std::cerr << "Cannot start curses on the benchmark pty.\n";
+    return EXIT_FAILURE;
+  }
+  set_term(screen);
+  setupScreen();
+  // Whatever curses writes has to be read off the master, or the pty fills up and blocks
+  std::atomic<uint64_t> ptyBytes(0);
+  std::thread drain([master, &ptyBytes]() {
+    char buf[16384];
+    ssize_t n;
+    while ((n = read(master, buf, sizeof(buf))) > 0) {
+      ptyBytes += static_cast<uint64_t>(n);
+    }
+  });
+
+  // Synthetic library and lyrics, sized like a real collection
+  std::vector<Track> library;
+  for (int i = 0; i < trackCount; i++) {
+    Track t;
+    t.path = "/bench/track" + std::to_string(i) + ".mp3";
+    t.title = "Track " + std::to_string(i) + " - Some Reasonably Long Song Title";
+    t.name = t.title;
+    t.titleLayout = layoutText(t.title);
+    t.artist = "Artist " + std::to_string(i % 97);
+    t.album = "Album " + std::to_string(i % 211);
+    t.duration = formatTime(static_cast<float>(120 + i % 300));
+    library.push_back(t);
+  }
+  std::vector<Track> stations;
+  for (int i = 0; i < 20; i++) {
+    stations.push_back(readM3uMetadata("/bench/station" + std::to_string(i) + ".m3u"));
+  }
+  LyricsResult lyrics;
+  lyrics.found = true;
+  for (int i = 0; i < 80; i++) {
+    std::string text = "Lyric line number " + std::to_string(i) + " sung over the beat";
+    lyrics.lines.push_back({static_cast<float>(i) * 3.f, text, layoutText(text), {}});
+  }
+  auto tracks = std::make_shared<const std::vector<Track>>(std::move(library));
+  auto radio = std::make_shared<const std::vector<Track>>(std::move(stations));
+  auto keys = loadKeyBindings(""); // the script is written against the default bindings
+
+  PlayerState state;
+  state.playlist = tracks;
+  state.keys = std::make_shared<const std::unordered_map<std::string, int>>(keys);
+  Histogram frames;
+  Histogram views[2]; // track list, lyrics
+  uint64_t bytes = 0;
+  uint64_t count = 0;
+  auto started = std::chrono::steady_clock::now();
+  for (char key : script) {
+    applyBenchKey(state, static_cast<unsigned char>(key), keys, tracks, radio);
+    for (int f = 0; f < framesPerKey; f++) {
+      if (state.musicStatus == sf::SoundSource::Playing) {
+        state.elapsed = std::min(state.total, state.elapsed + 1.f / 30.f);
       }
+      state.stamp = std::chrono::steady_clock::now();
+      bool lyricsView = (state.showHideLyrics != 0 && state.showOnlineRadio == 0);
+      uint64_t before = threadBytesWritten();
+      auto start = std::chrono::steady_clock::now();
+      drawFrame(state, &lyrics);
+      auto took = std::chrono::steady_clock::now() - start;
+      bytes += threadBytesWritten() - before;
+      frames.record(took);
+      views[lyricsView ? 1 : 0].record(took);
+      count++;
     }
   }
-  currentLine = 0;
+  float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - started).count();
+  endwin();
+  delscreen(screen);
+  fclose(out);
+  fclose(in);
+  drain.join();
+  close(master);
+
+  std::cout << "keys: " << script.size() << " frames: " << count << " tracks: " << trackCount << " in " << std::fixed << std::setprecision(3) << seconds << "s\n";
+  std::cout << "terminal bytes: " << bytes << " (" << ((count > 0) ? bytes / count : 0) << " per frame, " << ptyBytes.load() << " read from the pty)\n";
+  printStatsTable(std::cout, {{"all", &frames}, {"tracks", &views[0]}, {"lyrics", &views[1]}});
+  return EXIT_SUCCESS;
 }
 
-// Draw function tracks and status lines
-void drawStatus(int rows, int cols, std::vector<Track> playlist, int highlight, int colorPair, std::string status, int offset, bool shuffle, bool repeat, float volume, std::string &searchQuery, std::unordered_map<std::string, int> keys, int showHideAlbum, int showHideArtist, std::vector<Track> customPlaylist) {
-  if (playlist.empty()) {
-    return;
+// Lyrics pipeline benchmark: skip through a synthetic library the way a listener would and time
+// how long each track waits for its lyrics, how many requests each change costs and how long
+// the calls the render thread makes into the worker take. Uses a throwaway lyrics store.
+int runLyricsBenchmark(int trackCount, const std::string &url) {
+  std::string dir = (std::filesystem::temp_directory_path() / "0verau-bench-XXXXXX").string();
+  if (!mkdtemp(dir.data())) {
+    std::cerr << "Cannot create a directory for the benchmark store: " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
   }
-  if (currentTrack >= 0 && (currentTrack <= customPlaylist.size()) && !vlcPlaying) {
-    unsigned int x = 0U;
-    for (auto &z : customPlaylist) {
-      if (z.title == playlist[currentTrack].title) {
-        trackName = z.title;
-        break;
+  std::vector<Track> library;
+  for (int i = 0; i < trackCount; i++) {
+    Track t;
+    t.path = "/bench/lyrics" + std::to_string(i) + ".mp3";
+    t.title = "Song " + std::to_string(i);
+    t.name = t.title;
+    t.artist = "Artist " + std::to_string(i % 97);
+    t.album = "Album " + std::to_string(i % 211);
+    t.seconds = 200.f;
+    library.push_back(t);
+  }
+  settings.lrclibUrl = url;
+  settings.lyricsRate = 600; // the default 12 a minute would leave the prefetch pass waiting on tokens
+  const auto dwell = std::chrono::milliseconds(250); // time on each track before skipping
+  const auto giveUp = std::chrono::seconds(15);
+  httpClient.init();
+  // Cold store without and with prefetching, then the store the second pass filled
+  const struct { const char *name; int prefetch; bool fresh; } passes[] = {
+    {"cold", 0, true}, {"prefetch", settings.lyricsPrefetch, true}, {"warm", settings.lyricsPrefetch, false},
+  };
+  std::cout << "tracks: " << trackCount << " server: " << url << " dwell: " << dwell.count() << "ms\n";
+  std::cout << std::left << std::setw(10) << "pass" << std::right << std::setw(10) << "ttfl p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::setw(12) << "req/change" << std::setw(12) << "stall p99" << std::setw(10) << "max" << std::setw(10) << "found" << std::setw(10) << "timeout" << "\n";
+  for (auto &pass : passes) {
+    if (pass.fresh) {
+      std::error_code ec;
+      std::filesystem::remove(dir + "/lyrics.dat", ec);
+      std::filesystem::remove(dir + "/lyrics.idx", ec);
+      std::filesystem::remove(dir + "/lyrics.miss", ec);
+    }
+    lyricsStore.open(dir, settings.lyricsStoreBytes);
+    LyricsWorker worker;
+    worker.cache.setCapacity(settings.lyricsCacheBytes);
+    worker.setPrefetchRate(settings.lyricsRate);
+    worker.start();
+    Histogram firstLyric; // track change until its lyrics, or their absence, are known
+    Histogram stall;      // each call the render thread makes into the worker
+    int found = 0;
+    int timedOut = 0;
+    uint64_t requestsBefore = httpClient.requests;
+    for (int i = 0; i < trackCount; i++) {
+      const Track &track = library[static_cast<size_t>(i)];
+      auto changed = std::chrono::steady_clock::now();
+      worker.request(track);
+      std::vector<Track> next;
+      for (int n = 1; n <= pass.prefetch && i + n < trackCount; n++) {
+        next.push_back(library[static_cast<size_t>(i + n)]);
+      }
+      worker.prefetch(std::move(next));
+      stall.record(std::chrono::steady_clock::now() - changed);
+      while (true) {
+        auto start = std::chrono::steady_clock::now();
+        auto lyrics = worker.result(track);
+        auto now = std::chrono::steady_clock::now();
+        stall.record(now - start);
+        if (lyrics) {
+          firstLyric.record(now - changed);
+          found += lyrics->found ? 1 : 0;
+          break;
+        }
+        if (now - changed > giveUp) {
+          timedOut++;
+          break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
       }
-      x++;
+      std::this_thread::sleep_until(changed + dwell);
+    }
+    worker.stop();
+    lyricsStore.close();
+    double perChange = static_cast<double>(httpClient.requests - requestsBefore) / trackCount;
+    std::cout << std::left << std::setw(10) << pass.name << std::right << std::fixed << std::setprecision(3) << std::setw(10) << firstLyric.percentile(0.50) << std::setw(10) << firstLyric.percentile(0.99) << std::setw(10) << static_cast<double>(firstLyric.max.load()) / 1000.0 << std::setprecision(2) << std::setw(12) << perChange << std::setprecision(3) << std::setw(12) << stall.percentile(0.99) << std::setw(10) << static_cast<double>(stall.max.load()) / 1000.0 << std::setw(10) << found << std::setw(10) << timedOut << "\n";
+  }
+  httpClient.cleanup();
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+  return EXIT_SUCCESS;
+}
+
+// Event callback for metadata changes
+static void handle_event(const libvlc_event_t *event, void *user_data) {
+  if (event->type == libvlc_MediaMetaChanged) {
+    libvlc_media_t *media2 = static_cast<libvlc_media_t *>(user_data);
+    //const char *title = libvlc_media_get_meta(media2, libvlc_meta_Title);
+    //const char *title2 = libvlc_media_get_meta(media2, libvlc_meta_Artist);
+    //const char *title3 = libvlc_media_get_meta(media2, libvlc_meta_Album);
+    char *title4 = libvlc_media_get_meta(media2, libvlc_meta_NowPlaying);
+    if (title4) {
+      std::lock_guard<std::mutex> lock(vlcMetaMutex);
+      vlcSongMeta = title4;
+      vlcMetaChanged = true;
+      libvlc_free(title4);
+      wakeControl();
+    }
+  }
+}
+
+// Signal handler for Ctrl+C
+void signal_handler(int) {
+  running = false;
+}
+
+// Trim whitespace
+static inline std::string trim(const std::string &s) {
+  auto start = s.find_first_not_of(" \t\r\n");
+  auto end = s.find_last_not_of(" \t\r\n");
+  return (start == std::string::npos) ? "" : s.substr(start, end - start + 1);
+}
+
+// Parse .m3u playlist
+std::vector<std::string> parseM3U(const std::vector<std::string> &filename) {
+  std::vector<std::string> urls;
+  for (auto &x : filename) {
+    std::ifstream file(x);
+    if (!file) {
+      return urls;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      line = trim(line);
+      if (line.empty() || line[0] == '#') continue;
+      urls.push_back(line);
     }
-    currentTrack = x;
   }
-  if (!mp3Name.empty() && !vlcPlaying) {
-    trackName = mp3Name;
+  return urls;
+}
+
+void LyricsWorker::start() {
+  thread = std::thread(&LyricsWorker::run, this);
+}
+
+void LyricsWorker::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
   }
-  if (vlcPlaying) {
-    trackName = vlcSongMeta;
+  wake.notify_one();
+  if (thread.joinable()) {
+    thread.join();
   }
-  if (static_cast<int>(trackName.size()) > cols - 20) {
-    trackName = trackName.substr(0, cols - 23) + "...";
+}
+
+// Ask for the lyrics of a track, returns immediately
+void LyricsWorker::request(const Track &track) {
+  uint64_t id = trackId(track);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (wanted == id) {
+      return; // already queued, being fetched or done
+    }
+    wanted = id;
+    if (loading == id || cache.get(id)) {
+      return; // a prefetch got there first
+    }
+    queue.push_back(track);
   }
+  wake.notify_one();
+}
 
-  attron(COLOR_PAIR(colorPair) | A_BOLD);
-  mvprintw(0, 0, "%s", status.c_str());
-  mvprintw(0, 15, "%s", trackName.c_str());
-  attroff(COLOR_PAIR(colorPair) | A_BOLD);
+// Replace the tracks to fetch ahead of time, in play order
+void LyricsWorker::prefetch(std::vector<Track> tracks) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    upcoming.assign(std::make_move_iterator(tracks.begin()), std::make_move_iterator(tracks.end()));
+  }
+  wake.notify_one();
+}
 
-  mvprintw(1, 0, "%c %c Navigate | %c Play | %c Pause | SEEK %c left %c right | %c %c Volume UP/DOWN | %c Search | %c Shuffle | %c Repeat | %c Quit", keys["UP"], keys["DOWN"], keys["PLAY"], keys["PAUSE"], keys["SEEKLEFT"], keys["SEEKRIGHT"], keys["VOLUMEUP"], keys["VOLUMEDOWN"], keys["SEARCH"], keys["SHUFFLE"], keys["REPEAT"], keys["QUIT"]);
+void LyricsWorker::setPrefetchRate(int perMinute) {
+  std::lock_guard<std::mutex> lock(mutex);
+  rate = perMinute / 60.0;
+}
 
-  // Show playlist (scrollable)
-  int visibleRows = rows - 6;
-  if (highlight < offset) offset = highlight;
-  if (highlight >= offset + visibleRows) offset = highlight - visibleRows + 1;
+// Finished lyrics for a track, null while they are still being fetched
+std::shared_ptr<const LyricsResult> LyricsWorker::result(const Track &track) {
+  uint64_t id = trackId(track);
+  if (auto cached = cache.get(id)) {
+    return cached;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  return (latest && latest->id == id) ? latest : nullptr;
+}
 
-  for (int i = 0; i < visibleRows && i + offset < static_cast<int>(playlist.size()); ++i) {
-    int idx = i + offset;
-    if (idx == highlight) attron(A_REVERSE);
-    //mvprintw(i + 2, 0, "%s", playlist[idx].name.c_str());
-    mvprintw(i + 2, 0, "%d. %s %s %s %s", i + 1, ((showHideAlbum == 1) ? playlist[idx].album.c_str() : ""), ((showHideArtist == 1) ? playlist[idx].artist.c_str() : ""), playlist[idx].title.c_str(), playlist[idx].duration.c_str());
-    if (idx == highlight) attroff(A_REVERSE);
+void LyricsWorker::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  double tokens = burst;
+  auto refilled = std::chrono::steady_clock::now();
+  while (!stopping) {
+    auto now = std::chrono::steady_clock::now();
+    tokens = std::min(burst, tokens + std::chrono::duration<double>(now - refilled).count() * rate);
+    refilled = now;
+    Track track;
+    bool prefetching = false;
+    if (!queue.empty()) {
+      track = std::move(queue.front());
+      queue.pop_front();
+      if (trackId(track) != wanted) {
+        continue; // the track changed while this request waited
+      }
+    }
+    else if (!upcoming.empty() && tokens >= 1.0) {
+      track = std::move(upcoming.front());
+      upcoming.pop_front();
+      if (cache.get(trackId(track))) {
+        continue;
+      }
+      prefetching = true;
+    }
+    else {
+      // Sleep until there is a request, or until the next prefetch token is due
+      if (upcoming.empty()) {
+        wake.wait(lock);
+      }
+      else {
+        wake.wait_for(lock, std::chrono::duration<double>((1.0 - tokens) / rate));
+      }
+      continue;
+    }
+    uint64_t id = trackId(track);
+    loading = id;
+    lock.unlock();
+    auto start = std::chrono::steady_clock::now();
+    // Only a prefetch that goes out to lrclib costs a token, tags, the store and known misses are free.
+    // tokens is this thread's own, the lock is not needed for it.
+    auto found = std::make_shared<const LyricsResult>(loadTrackLyrics(track, [&]() {
+      if (prefetching) {
+        tokens -= 1.0;
+      }
+    }));
+    stats.lyrics.record(std::chrono::steady_clock::now() - start);
+    if (found->found) {
+      cache.put(found);
+    }
+    lock.lock();
+    loading = 0;
+    if (id == wanted) {
+      latest = std::move(found);
+      wakeRender();
+    }
   }
+}
 
-  // Show status
-  mvprintw(rows - 4, 0, "Tracks: %u | Shuffle: %s | Repeat: %s | Show Album %s | Show Artist %s | Volume: %u%%", static_cast<unsigned int>(playlist.size()), shuffle ? "ON" : "OFF", repeat ? "ON" : "OFF", showHideAlbum ? "ON" : "OFF", showHideArtist ? "ON" : "OFF" , static_cast<unsigned int>(volume));
+// Rough heap footprint of parsed lyrics, for the cache budget
+static size_t lyricsBytes(const LyricsResult &lyrics) {
+  size_t bytes = sizeof(LyricsResult) + lyrics.lines.capacity() * sizeof(LyricLine);
+  for (auto &line : lyrics.lines) {
+    bytes += line.text.capacity() + line.layout.clusters.capacity() * sizeof(line.layout.clusters[0]);
+  }
+  return bytes;
+}
 
-  // Show search query
-  if (!searchQuery.empty()) {
-    mvprintw(rows - 3, 0, "Search: %s", searchQuery.c_str());
+std::shared_ptr<const LyricsResult> LyricsCache::get(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(id);
+  if (it == index.end()) {
+    return nullptr;
   }
-  #pragma GCC diagnostic push
-  #pragma GCC diagnostic ignored "-Wstrict-overflow"
+  order.splice(order.begin(), order, it->second);
+  return *it->second;
 }
-#pragma GCC diagnostic pop
 
-// Filter playlist by search term
-std::vector<Track> filterTracks(const std::vector<Track> &tracks, const std::string &term) {
-  if (term.empty() || (term.length() >= 2 && term[1] == '/')) return tracks;
-  std::vector<Track> filtered;
-  for (auto &t : tracks) {
-    std::string lowerName = t.title;
-    std::string lowerTerm = term;
-    std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
-    std::transform(lowerTerm.begin(), lowerTerm.end(), lowerTerm.begin(), ::tolower);
-    if (lowerName.rfind(lowerTerm) != std::string::npos) {
-      filtered.push_back(t);
+void LyricsCache::put(std::shared_ptr<const LyricsResult> lyrics) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(lyrics->id);
+  if (it != index.end()) {
+    bytes -= lyricsBytes(**it->second);
+    order.erase(it->second);
+  }
+  bytes += lyricsBytes(*lyrics);
+  order.push_front(std::move(lyrics));
+  index[order.front()->id] = order.begin();
+  evict();
+}
+
+void LyricsCache::setCapacity(size_t limit) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity = limit;
+  evict();
+}
+
+// Drop least recently used entries until under budget, the newest entry always stays
+void LyricsCache::evict() {
+  while (bytes > capacity && order.size() > 1) {
+    bytes -= lyricsBytes(*order.back());
+    index.erase(order.back()->id);
+    order.pop_back();
+  }
+}
+
+// Split lyrics into lowercase words, apostrophes are dropped so "don't" matches "dont".
+// Bytes of multibyte characters count as letters, they are compared as they are.
+template <typename F>
+static void forEachWord(std::string_view text, F &&word) {
+  std::string current;
+  for (char c : text) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (std::isalnum(u) || u >= 0x80) {
+      current += static_cast<char>(std::tolower(u));
+    }
+    else if (c != '\'' && !current.empty()) {
+      word(current);
+      current.clear();
     }
   }
-  return filtered;
+  if (!current.empty()) {
+    word(current);
+  }
 }
 
-// List audio files in directory
-std::vector<Track> listAudioFiles(const std::string &path) {
-  std::vector<Track> files;
-  try {
-    for (const auto &entry : std::filesystem::directory_iterator(path)) {
-      if (entry.is_regular_file()) {
-        std::string ext = entry.path().extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        if (ext == ".wav" || ext == ".ogg" || ext == ".flac" || ext == ".mp3") {
-          files.push_back(readMetadata(entry.path()));
-          //files.push_back({entry.path().string(), entry.path().filename().string()});
-        }
+static void putVarint(std::string &out, uint32_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+static uint32_t getVarint(const char *&p) {
+  uint32_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    unsigned char byte = static_cast<unsigned char>(*p++);
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return value;
+    }
+  }
+}
+
+// Songs are added once, later copies of the same lyrics are ignored
+void LyricsIndex::add(uint64_t id, const std::vector<LyricLine> &lines) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!ids.insert(id).second) {
+    return;
+  }
+  uint32_t doc = static_cast<uint32_t>(docs.size());
+  docs.push_back({id, {}, {}});
+  Doc &entry = docs.back();
+  entry.lineStarts.reserve(lines.size());
+  entry.times.reserve(lines.size());
+  uint32_t pos = 0;
+  for (auto &line : lines) {
+    entry.lineStarts.push_back(pos);
+    entry.times.push_back(line.time);
+    forEachWord(line.text, [&](const std::string &word) {
+      auto it = words.find(word);
+      if (it == words.end()) {
+        it = words.emplace(word, Postings()).first;
+      }
+      // A block starts with the song and position, then the song delta and the position
+      // relative to the previous entry when it is in the same song
+      Postings &postings = it->second;
+      if (postings.count % blockSize == 0) {
+        postings.skips.emplace_back(static_cast<uint64_t>(doc) << 32 | pos, static_cast<uint32_t>(postings.data.size()));
+        putVarint(postings.data, doc);
+        putVarint(postings.data, pos);
+      }
+      else {
+        bool sameDoc = (postings.lastDoc == doc);
+        putVarint(postings.data, doc - postings.lastDoc);
+        putVarint(postings.data, sameDoc ? pos - postings.lastPos : pos);
       }
+      postings.count++;
+      postings.lastDoc = doc;
+      postings.lastPos = pos;
+      pos++;
+    });
+  }
+}
+
+bool LyricsIndex::contains(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return ids.count(id) != 0;
+}
+
+size_t LyricsIndex::songs() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return docs.size();
+}
+
+size_t LyricsIndex::bytes() {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t total = docs.capacity() * sizeof(Doc) + ids.size() * (sizeof(uint64_t) + 2 * sizeof(void *));
+  for (auto &doc : docs) {
+    total += doc.lineStarts.capacity() * sizeof(uint32_t) + doc.times.capacity() * sizeof(float);
+  }
+  for (auto &[word, postings] : words) {
+    total += sizeof(postings) + word.capacity() + postings.data.capacity() + postings.skips.capacity() * sizeof(postings.skips[0]) + 4 * sizeof(void *); // map node
+  }
+  return total;
+}
+
+// Step to the next key, false past the last one
+bool LyricsIndex::Cursor::next() {
+  if (!at) {
+    entry = 0;
+  }
+  else if (++entry >= postings->count) {
+    return false;
+  }
+  if (entry % blockSize == 0) {
+    block = entry / blockSize;
+    at = postings->data.data() + postings->skips[block].second;
+    uint32_t doc = getVarint(at);
+    uint32_t pos = getVarint(at);
+    key = static_cast<uint64_t>(doc) << 32 | pos;
+    return true;
+  }
+  uint32_t docDelta = getVarint(at);
+  uint32_t posDelta = getVarint(at);
+  uint32_t doc = static_cast<uint32_t>(key >> 32) + docDelta;
+  uint32_t pos = (docDelta > 0) ? posDelta : static_cast<uint32_t>(key) + posDelta;
+  key = static_cast<uint64_t>(doc) << 32 | pos;
+  return true;
+}
+
+// Move to the first key >= target, targets must not go backwards
+bool LyricsIndex::Cursor::seek(uint64_t target) {
+  if (at && key >= target) {
+    return true;
+  }
+  // Jump to the last block starting at or before target when that is past the current one
+  auto &skips = postings->skips;
+  auto after = std::upper_bound(skips.begin() + static_cast<std::ptrdiff_t>(block), skips.end(), target, [](uint64_t t, const std::pair<uint64_t, uint32_t> &skip) { return t < skip.first; });
+  size_t jump = static_cast<size_t>(after - skips.begin());
+  if (jump > 0 && (!at || jump - 1 > block)) {
+    entry = static_cast<uint32_t>((jump - 1) * blockSize) - 1;
+    at = postings->data.data(); // anything but null, next() reads from the skip entry
+  }
+  while (next()) {
+    if (key >= target) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Postings of a word, or of every word starting with it
+std::vector<const LyricsIndex::Postings *> LyricsIndex::lookup(const std::string &word, bool prefix) const {
+  std::vector<const Postings *> lists;
+  if (!prefix) {
+    auto it = words.find(word);
+    if (it != words.end()) {
+      lists.push_back(&it->second);
+    }
+    return lists;
+  }
+  for (auto it = words.lower_bound(word); it != words.end() && it->first.compare(0, word.size(), word) == 0; ++it) {
+    lists.push_back(&it->second);
+  }
+  return lists;
+}
+
+// Sorted keys of all the lists, moved back by offset words, keys that would go before the song are dropped
+std::vector<uint64_t> LyricsIndex::decode(const std::vector<const Postings *> &lists, size_t offset) {
+  std::vector<uint64_t> keys;
+  for (const Postings *postings : lists) {
+    Cursor cursor{postings};
+    while (cursor.next()) {
+      if (static_cast<uint32_t>(cursor.key) >= offset) {
+        keys.push_back(cursor.key - offset);
+      }
+    }
+  }
+  if (lists.size() > 1) {
+    std::stable_sort(keys.begin(), keys.end());
+  }
+  return keys;
+}
+
+// Songs containing the phrase, most matches first
+std::vector<LyricsHit> LyricsIndex::search(std::string_view query, size_t limit) {
+  std::vector<std::string> terms;
+  forEachWord(query, [&](const std::string &word) { terms.push_back(word); });
+  std::vector<LyricsHit> hits;
+  if (terms.empty()) {
+    return hits;
+  }
+  // A query ending in a space wants its last word whole, one or two letters would match half the index
+  bool prefix = !query.empty() && query.back() != ' ' && terms.back().size() >= 3;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<std::vector<const Postings *>> lists(terms.size());
+  std::vector<size_t> order(terms.size());
+  std::vector<uint64_t> counts(terms.size());
+  for (size_t k = 0; k < terms.size(); k++) {
+    lists[k] = lookup(terms[k], prefix && k + 1 == terms.size());
+    for (const Postings *postings : lists[k]) {
+      counts[k] += postings->count;
+    }
+    if (counts[k] == 0) {
+      return hits;
+    }
+    order[k] = k;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return counts[a] < counts[b]; });
+  // Phrase starts from every occurrence of the rarest word, sorted
+  size_t rarest = order[0];
+  std::vector<uint64_t> starts = decode(lists[rarest], rarest);
+  // Keep the starts whose k-th word is at start + k, the other words from rarest to most common.
+  // Few starts probe the lists block by block, many are cheaper to merge with the decoded lists.
+  for (size_t i = 1; i < order.size() && !starts.empty(); i++) {
+    size_t k = order[i];
+    size_t kept = 0;
+    if (lists[k].size() == 1 || starts.size() * lists[k].size() * blockSize < counts[k]) {
+      std::vector<Cursor> cursors;
+      for (const Postings *postings : lists[k]) {
+        cursors.push_back({postings});
+      }
+      for (uint64_t start : starts) {
+        bool match = false;
+        for (Cursor &cursor : cursors) {
+          match = (cursor.postings && cursor.seek(start + k) && cursor.key == start + k) || match;
+        }
+        if (match) {
+          starts[kept++] = start;
+        }
+      }
+    }
+    else {
+      std::vector<uint64_t> keys = decode(lists[k], k);
+      auto it = keys.begin();
+      for (uint64_t start : starts) {
+        it = std::lower_bound(it, keys.end(), start);
+        if (it == keys.end()) {
+          break;
+        }
+        if (*it == start) {
+          starts[kept++] = start;
+        }
+      }
+    }
+    starts.resize(kept);
+  }
+  // One hit per song, at the line of its first match
+  for (uint64_t start : starts) {
+    uint32_t doc = static_cast<uint32_t>(start >> 32);
+    if (!hits.empty() && hits.back().id == docs[doc].id) {
+      hits.back().matches++;
+      continue;
+    }
+    const Doc &entry = docs[doc];
+    size_t line = static_cast<size_t>(std::upper_bound(entry.lineStarts.begin(), entry.lineStarts.end(), static_cast<uint32_t>(start)) - entry.lineStarts.begin());
+    hits.push_back({entry.id, (line > 0) ? entry.times[line - 1] : 0.f, 1});
+  }
+  std::stable_sort(hits.begin(), hits.end(), [](const LyricsHit &a, const LyricsHit &b) { return a.matches > b.matches; });
+  if (hits.size() > limit) {
+    hits.resize(limit);
+  }
+  return hits;
+}
+
+// Index the lyrics store for search in the background, for the tracks of the library
+void indexStoredLyrics(std::vector<Track> tracks) {
+  std::string lrc;
+  for (auto &track : tracks) {
+    if (!running) {
+      return;
+    }
+    uint64_t id = trackId(track);
+    bool plain = false;
+    if (!lyricsIndex.contains(id) && lyricsStore.peek(id, lrc, plain)) {
+      lyricsIndex.add(id, parseLyrics(plain ? spreadLyrics(lrc, track.seconds) : lrc));
+    }
+  }
+}
+
+constexpr uint32_t LYRICS_RECORD_MAGIC = 0x4c79724f; // "OryL"
+constexpr uint32_t LYRICS_INDEX_MAGIC = 0x4978724f;  // "OrxI"
+constexpr uint32_t LYRICS_INDEX_VERSION = 2;
+constexpr uint32_t LYRICS_PLAIN = 1; // record flag, the text has no timestamps and is spread over the song when read
+
+// Index file layout: this header, then one Record per stored track
+struct LyricsIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t covered; // data file bytes the records describe, anything after is scanned on open
+  uint64_t clock;
+};
+
+bool LyricsStore::open(const std::string &dir, size_t limit) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity = limit;
+  records.clear();
+  misses.clear();
+  end = live = clock = 0;
+  inode = 0; // so lockData() reads the index and misses, also when this file was open before
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  dataPath = dir + "/lyrics.dat";
+  indexPath = dir + "/lyrics.idx";
+  missPath = dir + "/lyrics.miss";
+  fd = ::open(dataPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    std::cerr << "Cannot open the lyrics store " << dataPath << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  if (!lockData()) {
+    std::cerr << "Cannot lock the lyrics store " << dataPath << ": " << strerror(errno) << "\n";
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  unlockData();
+  return true;
+}
+
+// Read the index and the misses, then scan what the index does not cover, called with the data file locked
+void LyricsStore::load() {
+  std::unordered_map<uint64_t, Record> previous;
+  previous.swap(records);
+  end = live = 0;
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    end = static_cast<uint64_t>(st.st_size);
+    inode = st.st_ino;
+  }
+  uint64_t covered = 0;
+  std::ifstream in(indexPath, std::ios::binary);
+  LyricsIndexHeader header;
+  if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) && header.magic == LYRICS_INDEX_MAGIC && header.version == LYRICS_INDEX_VERSION && header.covered <= end) {
+    covered = header.covered;
+    clock = std::max(clock, header.clock);
+    Record record;
+    while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+      if (record.offset + record.size <= covered) {
+        records[record.id] = record;
+        live += sizeof(RecordHeader) + record.size;
+      }
+    }
+  }
+  scan(covered);
+  // Keep what this process knows about recent use, the index only has what was saved
+  for (auto &entry : records) {
+    auto it = previous.find(entry.first);
+    if (it != previous.end()) {
+      entry.second.used = std::max(entry.second.used, it->second.used);
+    }
+  }
+  loadMisses();
+}
+
+// Merge the misses file into the ones in memory, the later expiry wins
+void LyricsStore::loadMisses() {
+  std::ifstream missIn(missPath, std::ios::binary);
+  int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  std::pair<uint64_t, int64_t> miss;
+  while (missIn.read(reinterpret_cast<char *>(&miss), sizeof(miss))) {
+    if (miss.second > now) {
+      int64_t &expires = misses[miss.first];
+      expires = std::max(expires, miss.second);
+    }
+  }
+}
+
+// Pick up records appended after the index was last saved, a torn record at the end is cut off
+void LyricsStore::scan(uint64_t from) {
+  uint64_t pos = from;
+  RecordHeader header;
+  while (pos + sizeof(header) <= end) {
+    if (pread(fd, &header, sizeof(header), static_cast<off_t>(pos)) != static_cast<ssize_t>(sizeof(header)) || header.magic != LYRICS_RECORD_MAGIC || pos + sizeof(header) + header.size > end) {
+      break;
+    }
+    auto it = records.find(header.id);
+    if (it != records.end()) {
+      live -= sizeof(RecordHeader) + it->second.size;
+    }
+    records[header.id] = {header.id, pos + sizeof(header), header.size, header.rawSize, ++clock, header.flags, 0};
+    live += sizeof(header) + header.size;
+    pos += sizeof(header) + header.size;
+  }
+  if (pos < end && ftruncate(fd, static_cast<off_t>(pos)) == 0) {
+    end = pos;
+  }
+}
+
+bool LyricsStore::lockData() {
+  struct stat onDisk, ours;
+  while (true) {
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &ours) != 0) {
+      return false;
+    }
+    if (stat(dataPath.c_str(), &onDisk) == 0 && onDisk.st_ino == ours.st_ino && onDisk.st_dev == ours.st_dev) {
+      break;
+    }
+    // Another process compacted the store, follow it to the new file
+    int next = ::open(dataPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (next < 0) {
+      flock(fd, LOCK_UN);
+      return false;
+    }
+    ::close(fd);
+    fd = next;
+  }
+  if (ours.st_ino != inode || static_cast<uint64_t>(ours.st_size) < end) {
+    load();
+  }
+  else if (static_cast<uint64_t>(ours.st_size) > end) {
+    uint64_t from = end;
+    end = static_cast<uint64_t>(ours.st_size);
+    scan(from);
+  }
+  return true;
+}
+
+void LyricsStore::unlockData() {
+  flock(fd, LOCK_UN);
+}
+
+void LyricsStore::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd < 0) {
+    return;
+  }
+  if (lockData()) {
+    saveIndex();
+    unlockData();
+  }
+  ::close(fd);
+  fd = -1;
+}
+
+// LRC text of a track, false when it is not stored. plain is set for lyrics without timestamps.
+bool LyricsStore::get(uint64_t id, std::string &lrc, bool &plain) {
+  return read(id, lrc, plain, true);
+}
+
+// Like get, but does not count as a use, so the song is not kept longer when the store is compacted
+bool LyricsStore::peek(uint64_t id, std::string &lrc, bool &plain) {
+  return read(id, lrc, plain, false);
+}
+
+bool LyricsStore::read(uint64_t id, std::string &lrc, bool &plain, bool use) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = records.find(id);
+  if (fd < 0 || it == records.end()) {
+    return false;
+  }
+  Record &record = it->second;
+  std::string packed(record.size, '\0');
+  lrc.resize(record.rawSize);
+  uLongf rawSize = record.rawSize;
+  if (pread(fd, packed.data(), packed.size(), static_cast<off_t>(record.offset)) != static_cast<ssize_t>(packed.size()) || uncompress(reinterpret_cast<Bytef *>(lrc.data()), &rawSize, reinterpret_cast<const Bytef *>(packed.data()), packed.size()) != Z_OK || rawSize != record.rawSize) {
+    live -= sizeof(RecordHeader) + record.size;
+    records.erase(it); // damaged, fetch it again
+    lrc.clear();
+    return false;
+  }
+  if (use) {
+    record.used = ++clock;
+  }
+  plain = (record.flags & LYRICS_PLAIN) != 0;
+  return true;
+}
+
+// Whether a track's lyrics are stored, without reading them
+bool LyricsStore::contains(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return records.count(id) != 0;
+}
+
+// Remember that a track has no lyrics for ttl, so it is not asked for again until then
+void LyricsStore::putMissing(uint64_t id, std::chrono::seconds ttl) {
+  std::lock_guard<std::mutex> lock(mutex);
+  int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  misses[id] = now + ttl.count();
+}
+
+// Whether a lookup for the track failed recently enough to skip the network
+bool LyricsStore::missing(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = misses.find(id);
+  if (it == misses.end()) {
+    return false;
+  }
+  int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  if (it->second <= now) {
+    misses.erase(it);
+    return false;
+  }
+  return true;
+}
+
+void LyricsStore::put(uint64_t id, std::string_view lrc, bool plain) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd < 0) {
+    return;
+  }
+  uLongf size = compressBound(lrc.size());
+  std::string buffer(sizeof(RecordHeader) + size, '\0');
+  if (compress2(reinterpret_cast<Bytef *>(buffer.data() + sizeof(RecordHeader)), &size, reinterpret_cast<const Bytef *>(lrc.data()), lrc.size(), Z_BEST_COMPRESSION) != Z_OK) {
+    return;
+  }
+  RecordHeader header = {LYRICS_RECORD_MAGIC, static_cast<uint32_t>(size), static_cast<uint32_t>(lrc.size()), plain ? LYRICS_PLAIN : 0, id};
+  memcpy(buffer.data(), &header, sizeof(header));
+  buffer.resize(sizeof(header) + size);
+  if (!lockData()) {
+    return;
+  }
+  // The record starts wherever the append put it, not where this process last saw the end
+  off_t after = -1;
+  if (write(fd, buffer.data(), buffer.size()) != static_cast<ssize_t>(buffer.size()) || (after = lseek(fd, 0, SEEK_CUR)) < static_cast<off_t>(buffer.size())) {
+    if (ftruncate(fd, static_cast<off_t>(end)) != 0) {
+      std::cerr << "Cannot write the lyrics store " << dataPath << "\n";
+    }
+    unlockData();
+    return;
+  }
+  auto it = records.find(id);
+  if (it != records.end()) {
+    live -= sizeof(RecordHeader) + it->second.size;
+  }
+  end = static_cast<uint64_t>(after);
+  records[id] = {id, end - size, header.size, header.rawSize, ++clock, header.flags, 0};
+  live += buffer.size();
+  if (end > capacity) {
+    compact();
+  }
+  unlockData();
+}
+
+// Keep the most recently used records up to 3/4 of the cap and rewrite the data file with them,
+// called with the data file locked
+void LyricsStore::compact() {
+  std::vector<Record> kept;
+  kept.reserve(records.size());
+  for (auto &entry : records) {
+    kept.push_back(entry.second);
+  }
+  std::stable_sort(kept.begin(), kept.end(), [](const Record &a, const Record &b) { return a.used > b.used; });
+  uint64_t budget = capacity / 4 * 3;
+  uint64_t bytes = 0;
+  size_t count = 0;
+  while (count < kept.size() && bytes + sizeof(RecordHeader) + kept[count].size <= budget) {
+    bytes += sizeof(RecordHeader) + kept[count++].size;
+  }
+  kept.resize(count);
+  std::stable_sort(kept.begin(), kept.end(), [](const Record &a, const Record &b) { return a.offset < b.offset; });
+  std::string tmpPath = dataPath + ".tmp";
+  int out = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  // Locked before anyone can see it, so others wait until the new index is saved too
+  if (out < 0 || flock(out, LOCK_EX) != 0) {
+    if (out >= 0) {
+      ::close(out);
+      unlink(tmpPath.c_str());
+    }
+    return;
+  }
+  uint64_t pos = 0;
+  std::string buffer;
+  for (auto &record : kept) {
+    buffer.resize(sizeof(RecordHeader) + record.size);
+    off_t from = static_cast<off_t>(record.offset - sizeof(RecordHeader));
+    if (pread(fd, buffer.data(), buffer.size(), from) != static_cast<ssize_t>(buffer.size()) || write(out, buffer.data(), buffer.size()) != static_cast<ssize_t>(buffer.size())) {
+      ::close(out);
+      unlink(tmpPath.c_str());
+      return;
+    }
+    record.offset = pos + sizeof(RecordHeader);
+    pos += buffer.size();
+  }
+  struct stat st;
+  if (fstat(out, &st) != 0 || rename(tmpPath.c_str(), dataPath.c_str()) != 0) {
+    ::close(out);
+    unlink(tmpPath.c_str());
+    return;
+  }
+  ::close(fd); // drops the lock on the old file, whoever was waiting on it follows the rename
+  fd = out;
+  inode = st.st_ino;
+  records.clear();
+  for (auto &record : kept) {
+    records[record.id] = record;
+  }
+  end = live = pos;
+  saveIndex();
+}
+
+// Written to a temporary file and renamed, a crash leaves the old index and the scan catches up,
+// called with the data file locked
+void LyricsStore::saveIndex() {
+  std::string tmpPath = indexPath + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  LyricsIndexHeader header = {LYRICS_INDEX_MAGIC, LYRICS_INDEX_VERSION, end, clock};
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (auto &entry : records) {
+    out.write(reinterpret_cast<const char *>(&entry.second), sizeof(entry.second));
+  }
+  out.close();
+  if (!out || rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+    unlink(tmpPath.c_str());
+  }
+  // Misses are few and short lived, they are simply rewritten with the ones other processes saved
+  loadMisses();
+  std::string missTmpPath = missPath + ".tmp";
+  std::ofstream missOut(missTmpPath, std::ios::binary | std::ios::trunc);
+  for (auto &miss : misses) {
+    missOut.write(reinterpret_cast<const char *>(&miss), sizeof(miss));
+  }
+  missOut.close();
+  if (!missOut || rename(missTmpPath.c_str(), missPath.c_str()) != 0) {
+    unlink(missTmpPath.c_str());
+  }
+}
+
+// Fetch and parse the lyrics of a track, runs on the lyrics worker
+LyricsResult loadTrackLyrics(const Track &track, const std::function<void()> &onRequest) {
+  LyricsResult result;
+  result.id = trackId(track);
+  std::string lrc;
+  if (fetchTrackLyrics(track, lrc, onRequest) != FetchStatus::Ok) {
+    return result;
+  }
+  result.lines = parseLyrics(lrc);
+  result.found = !result.lines.empty();
+  if (result.found) {
+    lyricsIndex.add(result.id, result.lines);
+  }
+  return result;
+}
+
+// LRC text of a track from its tags, the lyrics store, or from lrclib into the store.
+// Unsynced lyrics are only used when there are no synced ones anywhere, the ones from the tags first.
+FetchStatus fetchTrackLyrics(const Track &track, std::string &lrc, const std::function<void()> &onRequest) {
+  std::string embedded;
+  bool synced = false;
+  if (track.embeddedLyrics && readEmbeddedLyrics(track.path, embedded, synced) && synced) {
+    lrc = std::move(embedded);
+    return FetchStatus::Ok;
+  }
+  bool plain = false;
+  FetchStatus status = fetchStoredLyrics(track, lrc, plain, onRequest);
+  if (status == FetchStatus::Ok && !plain) {
+    return status;
+  }
+  if (!embedded.empty()) {
+    lrc = spreadLyrics(embedded, track.seconds);
+    return FetchStatus::Ok;
+  }
+  if (status == FetchStatus::Ok) {
+    lrc = spreadLyrics(lrc, track.seconds);
+  }
+  return status;
+}
+
+// Lyrics of a track from the lyrics store, or from lrclib into the store. plain is set when
+// lrclib only had them without timestamps, lrc is then the bare text.
+static FetchStatus fetchStoredLyrics(const Track &track, std::string &lrc, bool &plain, const std::function<void()> &onRequest) {
+  uint64_t id = trackId(track);
+  plain = false;
+  if (lyricsStore.get(id, lrc, plain) || importLegacyLyrics(track, lrc)) {
+    return FetchStatus::Ok;
+  }
+  if (lyricsStore.missing(id)) {
+    return FetchStatus::NotFound;
+  }
+  std::string apiUrl = settings.lrclibUrl + "/api/get?artist_name=" + httpClient.escape(track.artist) + "&track_name=" + httpClient.escape(track.title);
+  std::string response;
+  if (onRequest) {
+    onRequest();
+  }
+  FetchStatus status = fetchLyrics(apiUrl, response);
+  if (status != FetchStatus::Ok) {
+    if (running) {
+      lyricsStore.putMissing(id, (status == FetchStatus::NotFound) ? std::chrono::seconds(std::chrono::hours(24) * settings.lyricsMissDays) : std::chrono::seconds(std::chrono::minutes(settings.lyricsErrorMinutes)));
+    }
+    return status;
+  }
+  LrclibLyrics fields;
+  if (!parseLrclibResponse(response, fields)) {
+    lyricsStore.putMissing(id, std::chrono::minutes(settings.lyricsErrorMinutes)); // truncated or not JSON
+    return FetchStatus::Error;
+  }
+  if (fields.synced.empty() && fields.plain.empty()) {
+    // Instrumental or null lyrics are as good as not found
+    lyricsStore.putMissing(id, std::chrono::hours(24) * settings.lyricsMissDays);
+    return FetchStatus::NotFound;
+  }
+  // Plain text only is stored as it is, it is spread over the song when read
+  plain = fields.synced.empty();
+  lrc = plain ? std::move(fields.plain) : std::move(fields.synced);
+  lyricsStore.put(id, lrc, plain);
+  return FetchStatus::Ok;
+}
+
+// Move an lrclib answer older versions saved next to the song into the lyrics store
+static bool importLegacyLyrics(const Track &track, std::string &lrc) {
+  // Saved as the song's path with spaces turned into underscores, plus .lrc
+  std::string path = track.path;
+  std::replace(path.begin(), path.end(), ' ', '_');
+  std::ifstream in(path + ".lrc", std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::string response((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  LrclibLyrics fields;
+  if (!parseLrclibResponse(response, fields) || fields.synced.empty()) {
+    return false;
+  }
+  lrc = std::move(fields.synced);
+  lyricsStore.put(trackId(track), lrc, false);
+  return true;
+}
+
+// Lyrics from the tags of a file, SYLT frames become LRC text, synced tells whether there were timestamps
+bool readEmbeddedLyrics(const std::string &path, std::string &text, bool &synced) {
+  text.clear();
+  synced = false;
+  TagLib::FileRef f(path.c_str());
+  if (f.isNull() || !f.file()) {
+    return false;
+  }
+  char stamp[16];
+  auto *mpeg = dynamic_cast<TagLib::MPEG::File *>(f.file());
+  if (mpeg && mpeg->ID3v2Tag() && mpeg->ID3v2Tag()->frameListMap().contains("SYLT")) {
+    for (auto *frame : mpeg->ID3v2Tag()->frameListMap()["SYLT"]) {
+      auto *sylt = dynamic_cast<TagLib::ID3v2::SynchronizedLyricsFrame *>(frame);
+      if (!sylt) continue;
+      // Timestamps are milliseconds or MPEG frames of 1152 samples
+      double unit = 0.001;
+      if (sylt->timestampFormat() == TagLib::ID3v2::SynchronizedLyricsFrame::AbsoluteMpegFrames) {
+        int rate = mpeg->audioProperties() ? mpeg->audioProperties()->sampleRate() : 0;
+        unit = (rate > 0) ? 1152.0 / rate : 1152.0 / 44100.0;
+      }
+      for (auto &entry : sylt->synchedText()) {
+        std::string line = entry.text.to8Bit(true);
+        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+        std::replace(line.begin(), line.end(), '\n', ' ');
+        double seconds = entry.time * unit;
+        int minutes = static_cast<int>(seconds / 60.0);
+        snprintf(stamp, sizeof(stamp), "[%02d:%05.2f]", minutes, seconds - minutes * 60.0);
+        text += stamp + trim(line) + "\n";
+      }
+      if (!text.empty()) {
+        synced = true;
+        return true;
+      }
+    }
+  }
+  // USLT frames, Vorbis comments, FLAC and MP4 tags all show up here
+  TagLib::PropertyMap properties = f.file()->properties();
+  for (const char *key : {"LYRICS", "UNSYNCEDLYRICS"}) {
+    if (properties.contains(key) && !properties[key].isEmpty()) {
+      text = properties[key].toString("\n").to8Bit(true);
+      synced = !parseLyrics(text).empty(); // many taggers store LRC text there
+      return !text.empty();
+    }
+  }
+  return false;
+}
+
+// Turn unsynced lyrics into LRC text with the lines spread evenly over the track
+std::string spreadLyrics(std::string_view text, float seconds) {
+  std::vector<std::string_view> lines;
+  while (!text.empty()) {
+    size_t eol = text.find('\n');
+    std::string_view line = text.substr(0, eol);
+    text.remove_prefix((eol == std::string_view::npos) ? text.size() : eol + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (!line.empty()) {
+      lines.push_back(line);
+    }
+  }
+  // Without a length give every line four seconds
+  double step = (seconds > 0.f && !lines.empty()) ? seconds / static_cast<double>(lines.size()) : 4.0;
+  std::string lrc;
+  char stamp[16];
+  for (size_t i = 0; i < lines.size(); i++) {
+    double t = static_cast<double>(i) * step;
+    int minutes = static_cast<int>(t / 60.0);
+    snprintf(stamp, sizeof(stamp), "[%02d:%05.2f]", minutes, t - minutes * 60.0);
+    lrc += stamp;
+    lrc.append(lines[i]);
+    lrc += '\n';
+  }
+  return lrc;
+}
+
+// Fill the lyrics store for a whole library. Tracks already stored or known to be missing are
+// skipped, finished tracks are appended to a checkpoint so an interrupted run picks up where it
+// stopped even for lookups whose outcome had not reached the store index yet.
+int runLyricsPrefetch(const std::vector<Track> &tracks, int parallel) {
+  httpClient.init();
+  if (!lyricsStore.open(cacheDir(), settings.lyricsStoreBytes)) {
+    httpClient.cleanup();
+    return EXIT_FAILURE;
+  }
+  std::string checkpointPath = cacheDir() + "/prefetch.state";
+  std::unordered_set<uint64_t> finished;
+  {
+    std::ifstream in(checkpointPath, std::ios::binary);
+    uint64_t id;
+    while (in.read(reinterpret_cast<char *>(&id), sizeof(id))) {
+      finished.insert(id);
+    }
+  }
+  std::vector<const Track *> todo;
+  for (auto &track : tracks) {
+    uint64_t id = trackId(track);
+    if (track.embeddedSynced || finished.count(id) || lyricsStore.contains(id) || lyricsStore.missing(id)) {
+      continue;
+    }
+    // The library scan only noted that there is a LYRICS tag, look at it now
+    std::string embedded;
+    bool synced = false;
+    if (track.embeddedLyrics && readEmbeddedLyrics(track.path, embedded, synced) && synced) {
+      continue;
+    }
+    todo.push_back(&track);
+  }
+  std::cout << tracks.size() << " tracks, " << tracks.size() - todo.size() << " stored or known missing, fetching " << todo.size() << " with " << parallel << " in parallel" << std::endl;
+
+  std::ofstream checkpoint(checkpointPath, std::ios::binary | std::ios::app);
+  std::mutex checkpointMutex;
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> found{0}, missing{0}, failed{0};
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < parallel; i++) {
+    workers.emplace_back([&]() {
+      for (size_t idx = next++; idx < todo.size() && running; idx = next++) {
+        std::string lrc;
+        FetchStatus status = fetchTrackLyrics(*todo[idx], lrc, nullptr);
+        if (!running) {
+          break; // aborted by Ctrl+C, not an answer
+        }
+        (status == FetchStatus::Ok ? found : status == FetchStatus::NotFound ? missing : failed)++;
+        if (status != FetchStatus::Error) {
+          uint64_t id = trackId(*todo[idx]);
+          std::lock_guard<std::mutex> lock(checkpointMutex);
+          checkpoint.write(reinterpret_cast<const char *>(&id), sizeof(id));
+          checkpoint.flush();
+        }
+      }
+    });
+  }
+  // Progress on one line until every worker is done
+  auto report = [&]() {
+    size_t done = found + missing + failed;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "\r" << done << "/" << todo.size() << " | found " << found << " | missing " << missing << " | failed " << failed << " | " << std::fixed << std::setprecision(1) << static_cast<double>(done) / std::max(seconds, 0.001) << " tracks/s   " << std::flush;
+  };
+  while (running && found + missing + failed < todo.size()) {
+    report();
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  report();
+  std::cerr << std::endl;
+  checkpoint.close();
+  lyricsStore.close();
+  httpClient.cleanup();
+  if (!running) {
+    std::cout << "Interrupted, run it again to continue." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::filesystem::remove(checkpointPath); // everything ended up in the store or the negative cache
+  return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Function to draw the lyrics
+void drawLyrics(int rows, int cols, const PlayerState &state, const LyricsResult *result) {
+  if (state.musicStatus != sf::SoundSource::Playing) {
+    return;
+  }
+  if (!result) {
+    attron(COLOR_PAIR(2) | A_BOLD);
+    printw("Fetching lyrics...");
+    attroff(COLOR_PAIR(2) | A_BOLD);
+    return;
+  }
+  const std::vector<LyricLine> &lyrics = result->lines;
+  if (!result->found) {
+    attron(COLOR_PAIR(3) | A_BOLD);
+    printw("Can't find lyrics for this song. Switch back to the menu with the songs.");
+    attroff(COLOR_PAIR(3) | A_BOLD);
+    return;
+  }
+  float currentTime = snapshotOffset(state);
+  lyricTimeline.update(*result, currentTime, state.total);
+  size_t currentLine = lyricTimeline.line;
+  float scrollOffset = lyricTimeline.scroll;
+  // Draw lyrics with fractional offset
+  int centerY = rows / 2;
+  for (int i = -3; i <= 3; i++) {
+    int idx = static_cast<int>(currentLine) + i;
+    if (idx >= 0 && idx < static_cast<int>(lyrics.size())) {
+      int yPos = centerY + static_cast<int>(((i - scrollOffset) * 2)); // 2 = line spacing
+      if (yPos >= 0 && yPos < rows - 3) {
+        if (i == 0) attron(A_BOLD | A_STANDOUT);
+        const LyricLine &line = lyrics[idx];
+        if (line.layout.width > cols) {
+          mvprintw(yPos, 0, "%s", truncateToWidth(line.text, line.layout, cols).c_str());
+        }
+        else if (i == 0 && !line.words.empty()) {
+          // Enhanced LRC: only the words already sung stand out
+          size_t sung = 0;
+          for (size_t w = 0; w < line.words.size() && line.words[w].time <= currentTime; w++) {
+            sung = (w + 1 < line.words.size()) ? line.words[w + 1].offset : line.text.size();
+          }
+          mvprintw(yPos, (cols - line.layout.width) / 2, "%.*s", static_cast<int>(sung), line.text.c_str());
+          attroff(A_STANDOUT);
+          printw("%s", line.text.c_str() + sung);
+        }
+        else {
+          mvprintw(yPos, (cols - line.layout.width) / 2, "%s", line.text.c_str());
+        }
+        if (i == 0) attroff(A_BOLD | A_STANDOUT);
+      }
+    }
+  }
+}
+
+// Move to time t, lyrics may change between calls
+void LyricTimeline::update(const LyricsResult &lyrics, float t, float duration) {
+  const std::vector<LyricLine> &lines = lyrics.lines;
+  if (lines.empty()) {
+    line = 0;
+    scroll = 0.f;
+    return;
+  }
+  bool fresh = (current != &lyrics || id != lyrics.id || line >= lines.size());
+  current = &lyrics;
+  id = lyrics.id;
+  auto startsAfter = [&](size_t i) { return i >= lines.size() || t < lines[i].time; };
+  if (!fresh && t >= lines[line].time && startsAfter(line + 1)) {
+    // still on the same line
+  }
+  else if (!fresh && !startsAfter(line + 1) && startsAfter(line + 2)) {
+    line++;
+  }
+  else {
+    auto next = std::upper_bound(lines.begin(), lines.end(), t, [](float when, const LyricLine &l) { return when < l.time; });
+    line = (next == lines.begin()) ? 0 : static_cast<size_t>(next - lines.begin()) - 1;
+  }
+  float lineStartTime = lines[line].time;
+  float lineEndTime = (line + 1 < lines.size()) ? lines[line + 1].time : duration;
+  float lineDuration = lineEndTime - lineStartTime;
+  // Before the first line the view eases in from at most one line below
+  scroll = (lineDuration > 0.f) ? std::clamp((t - lineStartTime) / lineDuration, -1.f, 1.f) : 0.f;
+}
+
+// Draw function tracks and status lines
+void drawStatus(int rows, int cols, const PlayerState &state) {
+  const std::vector<Track> &playlist = *state.playlist;
+  const std::unordered_map<std::string, int> &keys = *state.keys;
+  if (playlist.empty()) {
+    return;
+  }
+  std::string name = state.trackName;
+  if (state.trackNameLayout.width > cols - 20) {
+    name = truncateToWidth(name, state.trackNameLayout, cols - 23) + "...";
+  }
+
+  attron(COLOR_PAIR(state.colorPair) | A_BOLD);
+  mvprintw(0, 0, "%s", state.status.c_str());
+  mvprintw(0, 15, "%s", name.c_str());
+  attroff(COLOR_PAIR(state.colorPair) | A_BOLD);
+
+  mvprintw(1, 0, "%c %c Navigate | %c Play | %c Pause | SEEK %c left %c right | %c %c Volume UP/DOWN | %c Search | %c Shuffle | %c Repeat | %c Quit", keys.at("UP"), keys.at("DOWN"), keys.at("PLAY"), keys.at("PAUSE"), keys.at("SEEKLEFT"), keys.at("SEEKRIGHT"), keys.at("VOLUMEUP"), keys.at("VOLUMEDOWN"), keys.at("SEARCH"), keys.at("SHUFFLE"), keys.at("REPEAT"), keys.at("QUIT"));
+
+  // Show playlist (scrollable)
+  int visibleRows = rows - 6;
+  int highlight = state.highlight;
+  int offset = state.offset;
+  if (highlight < offset) offset = highlight;
+  if (highlight >= offset + visibleRows) offset = highlight - visibleRows + 1;
+
+  for (int i = 0; i < visibleRows && i + offset < static_cast<int>(playlist.size()); ++i) {
+    int idx = i + offset;
+    if (idx == highlight) attron(A_REVERSE);
+    //mvprintw(i + 2, 0, "%s", playlist[idx].name.c_str());
+    mvprintw(i + 2, 0, "%d. %s %s %s %s", i + 1, ((state.showHideAlbum == 1) ? playlist[idx].album.c_str() : ""), ((state.showHideArtist == 1) ? playlist[idx].artist.c_str() : ""), playlist[idx].title.c_str(), playlist[idx].duration.c_str());
+    if (idx == highlight) attroff(A_REVERSE);
+  }
+
+  // Show status
+  mvprintw(rows - 4, 0, "Tracks: %u | Shuffle: %s | Repeat: %s | Show Album %s | Show Artist %s | Volume: %u%%", static_cast<unsigned int>(playlist.size()), state.shuffle ? "ON" : "OFF", state.repeat ? "ON" : "OFF", state.showHideAlbum ? "ON" : "OFF", state.showHideArtist ? "ON" : "OFF" , static_cast<unsigned int>(state.volume));
+
+  // Show search query
+  if (!state.searchQuery.empty()) {
+    mvprintw(rows - 3, 0, "Search: %s", state.searchQuery.c_str());
+  }
+  #pragma GCC diagnostic push
+  #pragma GCC diagnostic ignored "-Wstrict-overflow"
+}
+#pragma GCC diagnostic pop
+
+// Filter playlist by search term
+std::vector<Track> filterTracks(const std::vector<Track> &tracks, const std::string &term) {
+  if (term.empty() || (term.length() >= 2 && term[1] == '/')) return tracks;
+  std::vector<Track> filtered;
+  for (auto &t : tracks) {
+    std::string lowerName = t.title;
+    std::string lowerTerm = term;
+    std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+    std::transform(lowerTerm.begin(), lowerTerm.end(), lowerTerm.begin(), ::tolower);
+    if (lowerName.rfind(lowerTerm) != std::string::npos) {
+      filtered.push_back(t);
+    }
+  }
+  return filtered;
+}
+
+// List audio files in directory
+std::vector<Track> listAudioFiles(const std::string &path) {
+  std::vector<Track> files;
+  try {
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+      if (entry.is_regular_file()) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == ".wav" || ext == ".ogg" || ext == ".flac" || ext == ".mp3") {
+          auto start = std::chrono::steady_clock::now();
+          files.push_back(readMetadata(entry.path()));
+          stats.metadata.record(std::chrono::steady_clock::now() - start);
+          //files.push_back({entry.path().string(), entry.path().filename().string()});
+        }
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error reading directory: " << e.what() << "\n";
+  }
+  return files;
+}
+
+// List m3u online radio files in directory and reads the metadata
+std::vector<Track> listM3uFiles(const std::string &path) {
+  std::vector<Track> files;
+  try {
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+      if (entry.is_regular_file()) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == ".m3u") {
+          files.push_back(readM3uMetadata(entry.path()));
+          //files.push_back({entry.path().string(), entry.path().filename().string()});
+        }
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error reading directory: " << e.what() << "\n";
+  }
+  return files;
+}
+
+// List only the .m3u files and store their paths
+std::vector<std::string> listM3u(const std::string &path) {
+  std::vector<std::string> files;
+  try {
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+      if (entry.is_regular_file()) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == ".m3u") {
+          files.push_back(entry.path());
+          //files.push_back({entry.path().string(), entry.path().filename().string()});
+        }
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error reading directory: " << e.what() << "\n";
+  }
+  return files;
+}
+
+// Decode the first samples now, so starting the track later needs no disk access
+void Decoder::preroll(size_t count) {
+  prerolled.resize(count);
+  prerolled.resize(decode(prerolled.data(), count));
+  prerolledAt = 0;
+}
+
+// Up to count samples, prerolled ones first
+size_t Decoder::read(int16_t *samples, size_t count) {
+  size_t got = std::min(count, prerolled.size() - prerolledAt);
+  std::copy_n(prerolled.data() + prerolledAt, got, samples);
+  prerolledAt += got;
+  if (prerolledAt == prerolled.size() && !prerolled.empty()) {
+    prerolled.clear();
+    prerolled.shrink_to_fit();
+    prerolledAt = 0;
+  }
+  got += (got < count) ? decode(samples + got, count - got) : 0;
+  position += got / channels;
+  return got;
+}
+
+bool Decoder::seek(uint64_t frame) {
+  prerolled.clear();
+  prerolledAt = 0;
+  position = frame;
+  auto start = std::chrono::steady_clock::now();
+  bool ok = seekFrame(frame);
+  stats.seek.record(std::chrono::steady_clock::now() - start);
+  return ok;
+}
+
+Mpg123Decoder::~Mpg123Decoder() {
+  if (handle) {
+    mpg123_close(handle);
+    mpg123_delete(handle);
+  }
+}
+
+bool Mpg123Decoder::open(const std::string &file) {
+  path = file;
+  int err = MPG123_OK;
+  mpg123_init(); // a no-op after the first call
+  handle = mpg123_new(nullptr, &err);
+  if (!handle) {
+    return false;
+  }
+  mpg123_param(handle, MPG123_ADD_FLAGS, MPG123_GAPLESS | MPG123_QUIET, 0.0);
+  long sampleRate = 0;
+  int channelCount = 0;
+  int encoding = 0;
+  if (mpg123_open(handle, path.c_str()) != MPG123_OK || mpg123_getformat(handle, &sampleRate, &channelCount, &encoding) != MPG123_OK) {
+    return false;
+  }
+  // Keep the format of the first frame for the whole file, 16 bit
+  mpg123_format_none(handle);
+  mpg123_format(handle, sampleRate, channelCount, MPG123_ENC_SIGNED_16);
+  rate = static_cast<unsigned int>(sampleRate);
+  channels = static_cast<unsigned int>(channelCount);
+  off_t length = mpg123_length(handle); // without the encoder delay and padding
+  frames = (length > 0) ? static_cast<uint64_t>(length) : 0;
+  indexed = seekIndexer.load(path, handle, frames);
+  return true;
+}
+
+size_t Mpg123Decoder::decode(int16_t *samples, size_t count) {
+  size_t total = 0;
+  while (total < count) {
+    size_t done = 0;
+    int err = mpg123_read(handle, reinterpret_cast<unsigned char *>(samples + total), (count - total) * sizeof(int16_t), &done);
+    total += done / sizeof(int16_t);
+    if (err == MPG123_DONE || (err != MPG123_OK && err != MPG123_NEW_FORMAT) || (done == 0 && err != MPG123_NEW_FORMAT)) {
+      break;
+    }
+  }
+  return total;
+}
+
+bool Mpg123Decoder::seekFrame(uint64_t frame) {
+  if (!indexed) {
+    indexed = seekIndexer.load(path, handle, frames); // the scan may have finished since open()
+  }
+  auto start = std::chrono::steady_clock::now();
+  bool ok = mpg123_seek(handle, static_cast<off_t>(frame), SEEK_SET) >= 0;
+  // mpg123 had to read its way to the frame, have the file scanned so the next seek does not
+  if (!indexed && std::chrono::steady_clock::now() - start > SEEK_INDEX_SLOW) {
+    seekIndexer.request(path);
+  }
+  return ok;
+}
+
+constexpr uint32_t SEEK_INDEX_MAGIC = 0x6b65534f; // "OSek"
+constexpr uint32_t SEEK_INDEX_VERSION = 1;
+
+// Seek index file layout: this header, then fill frame offsets
+struct SeekIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;   // of the MP3 the index was built from
+  int64_t mtime;   // nanoseconds
+  uint64_t frames; // exact length in samples per channel, from the scan
+  int64_t step;    // MPEG frames between two offsets
+  uint64_t fill;
+};
+
+// Size and modification time of a file, false when it cannot be read
+static bool fileStamp(const std::string &path, uint64_t &size, int64_t &mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  size = static_cast<uint64_t>(st.st_size);
+  mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+void SeekIndexer::start(const std::string &directory, size_t limit) {
+  dir = directory;
+  capacity = limit;
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  thread = std::thread(&SeekIndexer::run, this);
+}
+
+void SeekIndexer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+// Scan path unless it is indexed, queued or failed to scan before, returns immediately
+void SeekIndexer::request(const std::string &path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = known.find(path);
+    if (!thread.joinable() || (it != known.end() && it->second != State::Absent) || std::find(queue.begin(), queue.end(), path) != queue.end()) {
+      return;
+    }
+    queue.push_back(path);
+  }
+  wake.notify_one();
+}
+
+// Index file of an MP3, named by the FNV-1a of its path like the lyrics store keys
+std::string SeekIndexer::file(const std::string &path) const {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : path) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.idx", static_cast<unsigned long long>(hash));
+  return dir + name;
+}
+
+bool SeekIndexer::load(const std::string &path, mpg123_handle *handle, uint64_t &frames) {
+  if (dir.empty()) {
+    return false;
+  }
+  {
+    // Only files never looked at and freshly scanned ones are read from disk
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = known.find(path);
+    if (it != known.end() && it->second != State::Stored) {
+      return false;
+    }
+  }
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  std::string indexPath = file(path);
+  std::ifstream in(indexPath, std::ios::binary);
+  SeekIndexHeader header;
+  std::vector<int64_t> stored;
+  bool ok = fileStamp(path, size, mtime) && in.read(reinterpret_cast<char *>(&header), sizeof(header)) && header.magic == SEEK_INDEX_MAGIC && header.version == SEEK_INDEX_VERSION && header.size == size && header.mtime == mtime && header.step > 0 && header.fill > 0 && header.fill <= static_cast<uint64_t>(SEEK_INDEX_ENTRIES);
+  if (ok) {
+    stored.resize(header.fill);
+    ok = static_cast<bool>(in.read(reinterpret_cast<char *>(stored.data()), static_cast<std::streamsize>(stored.size() * sizeof(int64_t))));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    known[path] = ok ? State::Stored : State::Absent;
+  }
+  if (!ok) {
+    return false;
+  }
+  utimensat(AT_FDCWD, indexPath.c_str(), nullptr, 0); // recently used, prune() keeps it longer
+  std::vector<off_t> offsets(stored.begin(), stored.end());
+  mpg123_param(handle, MPG123_INDEX_SIZE, SEEK_INDEX_ENTRIES, 0.0);
+  if (mpg123_set_index(handle, offsets.data(), static_cast<off_t>(header.step), offsets.size()) != MPG123_OK) { // mpg123 copies it
+    return false;
+  }
+  if (header.frames > 0) {
+    frames = header.frames;
+  }
+  return true;
+}
+
+// Scan one MP3 to its end on a handle of our own and store the index mpg123 built on the way
+bool SeekIndexer::build(const std::string &path) {
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  if (!fileStamp(path, size, mtime)) {
+    return false;
+  }
+  std::ifstream in(file(path), std::ios::binary);
+  SeekIndexHeader header;
+  if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) && header.magic == SEEK_INDEX_MAGIC && header.version == SEEK_INDEX_VERSION && header.size == size && header.mtime == mtime) {
+    return true; // stored already, by an earlier run or an earlier request
+  }
+  in.close();
+  int err = MPG123_OK;
+  mpg123_init();
+  mpg123_handle *handle = mpg123_new(nullptr, &err);
+  if (!handle) {
+    return false;
+  }
+  mpg123_param(handle, MPG123_ADD_FLAGS, MPG123_GAPLESS | MPG123_QUIET, 0.0); // the same length the player sees
+  mpg123_param(handle, MPG123_INDEX_SIZE, SEEK_INDEX_ENTRIES, 0.0);
+  off_t *offsets = nullptr;
+  off_t step = 0;
+  size_t fill = 0;
+  bool ok = mpg123_open(handle, path.c_str()) == MPG123_OK && mpg123_scan(handle) == MPG123_OK && mpg123_index(handle, &offsets, &step, &fill) == MPG123_OK && fill > 0 && step > 0;
+  if (ok) {
+    off_t length = mpg123_length(handle);
+    header = {SEEK_INDEX_MAGIC, SEEK_INDEX_VERSION, size, mtime, (length > 0) ? static_cast<uint64_t>(length) : 0, static_cast<int64_t>(step), fill};
+    std::vector<int64_t> stored(offsets, offsets + fill);
+    std::string indexPath = file(path);
+    std::string tmpPath = indexPath + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(stored.data()), static_cast<std::streamsize>(stored.size() * sizeof(int64_t)));
+    out.close();
+    ok = out && rename(tmpPath.c_str(), indexPath.c_str()) == 0;
+    if (!ok) {
+      unlink(tmpPath.c_str());
+    }
+  }
+  mpg123_close(handle);
+  mpg123_delete(handle);
+  return ok;
+}
+
+void SeekIndexer::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    if (queue.empty()) {
+      wake.wait(lock);
+      continue;
+    }
+    std::string path = queue.front();
+    lock.unlock();
+    bool ok = build(path); // reads the whole file once, never while holding the lock
+    if (ok) {
+      prune();
+    }
+    lock.lock();
+    known[path] = ok ? State::Stored : State::Failed; // a file mpg123 cannot scan is not tried again
+    queue.pop_front(); // only now, so request() does not queue it again meanwhile
+  }
+}
+
+// Once the indexes are over the cap, drop the least recently used down to 3/4 of it
+void SeekIndexer::prune() {
+  struct Entry {
+    std::filesystem::file_time_type used;
+    uintmax_t size;
+    std::filesystem::path path;
+  };
+  std::vector<Entry> entries;
+  uintmax_t total = 0;
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code statError;
+    Entry entry = {it->last_write_time(statError), it->file_size(statError), it->path()};
+    if (!statError && entry.path.extension() == ".idx") {
+      total += entry.size;
+      entries.push_back(entry);
+    }
+  }
+  if (total <= capacity) {
+    return;
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  for (auto &entry : entries) {
+    if (total <= capacity / 4 * 3) {
+      break;
+    }
+    if (std::filesystem::remove(entry.path, ec)) {
+      total -= entry.size;
+    }
+  }
+}
+
+// Little endian integer of n bytes
+static uint64_t littleEndian(const unsigned char *p, unsigned int n) {
+  uint64_t value = 0;
+  for (unsigned int i = n; i > 0; i--) {
+    value = (value << 8) | p[i - 1];
+  }
+  return value;
+}
+
+bool WavDecoder::open(const std::string &path) {
+  file.open(path, std::ios::binary);
+  unsigned char header[12];
+  if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || std::memcmp(header, "RIFF", 4) != 0 || std::memcmp(header + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+  unsigned int format = 0;
+  unsigned int bits = 0;
+  unsigned int blockAlign = 0;
+  unsigned char chunk[8];
+  while (file.read(reinterpret_cast<char *>(chunk), sizeof(chunk))) {
+    uint64_t size = littleEndian(chunk + 4, 4);
+    if (std::memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      unsigned char fmt[40] = {};
+      if (!file.read(reinterpret_cast<char *>(fmt), static_cast<std::streamsize>(std::min<uint64_t>(size, sizeof(fmt))))) {
+        return false;
+      }
+      format = static_cast<unsigned int>(littleEndian(fmt, 2));
+      channels = static_cast<unsigned int>(littleEndian(fmt + 2, 2));
+      rate = static_cast<unsigned int>(littleEndian(fmt + 4, 4));
+      blockAlign = static_cast<unsigned int>(littleEndian(fmt + 12, 2));
+      bits = static_cast<unsigned int>(littleEndian(fmt + 14, 2));
+      if (format == 0xFFFE && size >= 40) {
+        format = static_cast<unsigned int>(littleEndian(fmt + 24, 2)); // WAVE_FORMAT_EXTENSIBLE, the sub format GUID starts with the tag
+      }
+      file.seekg(static_cast<std::streamoff>(size - std::min<uint64_t>(size, sizeof(fmt)) + (size & 1)), std::ios::cur);
+    }
+    else if (std::memcmp(chunk, "data", 4) == 0) {
+      dataStart = static_cast<uint64_t>(file.tellg());
+      remaining = size;
+      break;
+    }
+    else {
+      file.seekg(static_cast<std::streamoff>(size + (size & 1)), std::ios::cur); // chunks are padded to even sizes
+    }
+  }
+  floating = (format == 3);
+  bytes = bits / 8;
+  bool supported = (format == 1 && bits >= 8 && bits <= 32 && bits % 8 == 0) || (floating && (bits == 32 || bits == 64));
+  if (!supported || dataStart == 0 || channels == 0 || rate == 0 || blockAlign != bytes * channels) {
+    return false;
+  }
+  remaining -= remaining % blockAlign;
+  frames = remaining / blockAlign;
+  return true;
+}
+
+size_t WavDecoder::decode(int16_t *samples, size_t count) {
+  size_t want = static_cast<size_t>(std::min<uint64_t>(count, remaining / bytes));
+  raw.resize(want * bytes);
+  file.read(reinterpret_cast<char *>(raw.data()), static_cast<std::streamsize>(raw.size()));
+  size_t got = static_cast<size_t>(file.gcount()) / bytes;
+  remaining -= got * bytes;
+  const unsigned char *p = raw.data();
+  for (size_t i = 0; i < got; i++, p += bytes) {
+    if (floating) {
+      double value = 0.0;
+      if (bytes == 4) {
+        value = static_cast<double>(std::bit_cast<float>(static_cast<uint32_t>(littleEndian(p, 4))));
+      }
+      else {
+        value = std::bit_cast<double>(littleEndian(p, 8));
+      }
+      samples[i] = static_cast<int16_t>(std::clamp(value * 32768.0, -32768.0, 32767.0));
+    }
+    else if (bytes == 1) {
+      samples[i] = static_cast<int16_t>((p[0] - 128) * 256); // 8 bit WAV is unsigned
+    }
+    else {
+      samples[i] = static_cast<int16_t>(littleEndian(p + bytes - 2, 2)); // the top 16 bits
+    }
+  }
+  return got;
+}
+
+bool WavDecoder::seekFrame(uint64_t frame) {
+  uint64_t blockAlign = static_cast<uint64_t>(bytes) * channels;
+  frame = std::min(frame, frames);
+  file.clear();
+  file.seekg(static_cast<std::streamoff>(dataStart + frame * blockAlign));
+  remaining = (frames - frame) * blockAlign;
+  return static_cast<bool>(file);
+}
+
+bool SoundFileDecoder::open(const std::string &path) {
+  if (!file.openFromFile(path)) {
+    return false;
+  }
+  channels = file.getChannelCount();
+  rate = file.getSampleRate();
+  frames = (channels > 0) ? file.getSampleCount() / channels : 0;
+  return channels > 0 && rate > 0;
+}
+
+size_t SoundFileDecoder::decode(int16_t *samples, size_t count) {
+  return static_cast<size_t>(file.read(samples, count));
+}
+
+bool SoundFileDecoder::seekFrame(uint64_t frame) {
+  file.seek(frame * channels); // SFML counts samples of all channels
+  return true;
+}
+
+// Open a decoder for a local file by its extension
+std::unique_ptr<Decoder> openDecoder(const std::string &path) {
+  std::string ext = std::filesystem::path(path).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  std::unique_ptr<Decoder> decoder;
+  if (ext == ".mp3") {
+    auto mp3 = std::make_unique<Mpg123Decoder>();
+    decoder = mp3->open(path) ? std::move(mp3) : nullptr;
+  }
+  else if (ext == ".wav") {
+    auto wav = std::make_unique<WavDecoder>();
+    decoder = wav->open(path) ? std::move(wav) : nullptr;
+  }
+  else {
+    auto other = std::make_unique<SoundFileDecoder>();
+    decoder = other->open(path) ? std::move(other) : nullptr;
+  }
+  if (decoder) {
+    decoder->source = path;
+  }
+  return decoder;
+}
+
+void SampleRing::allocate(size_t capacity) {
+  data.assign(std::max<size_t>(1, capacity), 0);
+  length.store(data.size(), std::memory_order_relaxed);
+  reset();
+}
+
+void SampleRing::reset() {
+  head.store(0, std::memory_order_relaxed);
+  tail.store(0, std::memory_order_relaxed);
+}
+
+size_t SampleRing::push(const int16_t *samples, size_t count) {
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t t = tail.load(std::memory_order_acquire); // the consumer is done with what it popped
+  count = std::min(count, data.size() - (h - t));
+  size_t at = h % data.size();
+  size_t first = std::min(count, data.size() - at);
+  std::copy_n(samples, first, data.data() + at);
+  std::copy_n(samples + first, count - first, data.data());
+  head.store(h + count, std::memory_order_release); // publishes the samples
+  return count;
+}
+
+size_t SampleRing::pop(int16_t *samples, size_t count) {
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t h = head.load(std::memory_order_acquire); // the samples up to h are written
+  count = std::min(count, h - t);
+  size_t at = t % data.size();
+  size_t first = std::min(count, data.size() - at);
+  std::copy_n(data.data() + at, first, samples);
+  std::copy_n(data.data(), count - first, samples + first);
+  tail.store(t + count, std::memory_order_release); // hands the space back
+  return count;
+}
+
+size_t SampleRing::size() const {
+  return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+AudioStream::~AudioStream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  stop(); // the streaming thread reads the ring, it has to end before the members go
+  wake.notify_all();
+  if (producer.joinable()) {
+    producer.join();
+  }
+}
+
+// Play a file from the start, false when it cannot be decoded
+bool AudioStream::open(const std::string &path) {
+  {
+    // Nothing to seek back to, the stop() below then has onSeek() leave the ring alone
+    std::unique_lock<std::mutex> lock(mutex);
+    waitIdle(lock);
+    current.reset();
+    next.reset();
+    previous.reset();
+    pendingFade.reset();
+    spliced = fading = false;
+  }
+  stop(); // joins the streaming thread, it must not hold the mutex meanwhile
+  std::unique_ptr<Decoder> decoder = openDecoder(path);
+  if (!decoder) {
+    return false;
+  }
+  unsigned int channelCount = decoder->channels;
+  unsigned int sampleRate = decoder->rate;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    waitIdle(lock);
+    current = std::move(decoder);
+    buffer.assign(std::max<size_t>(1, static_cast<size_t>(sampleRate) * static_cast<size_t>(bufferMs) / 1000) * channelCount, 0);
+    output.assign(buffer.size(), 0);
+    fadeOut.assign(buffer.size(), 0);
+    fadeIn.assign(buffer.size(), 0);
+    ring.allocate(std::max(buffer.size() * 4, static_cast<size_t>(sampleRate) * static_cast<size_t>(readAheadMs) / 1000 * channelCount));
+    decoded = trackStart = spliceAt = 0;
+    advance = false;
+    refill();
+    if (!producer.joinable()) {
+      producer = std::thread(&AudioStream::produce, this);
+    }
+  }
+  wake.notify_one();
+  initialize(channelCount, sampleRate);
+  play();
+  return true;
+}
+
+void AudioStream::setBufferLength(int milliseconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  bufferMs = std::clamp(milliseconds, 20, 1000);
+}
+
+void AudioStream::setReadAhead(int milliseconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  readAheadMs = std::clamp(milliseconds, 200, 10000);
+}
+
+float AudioStream::fill() const {
+  size_t capacity = ring.capacity();
+  return (capacity > 1) ? static_cast<float>(ring.size()) / static_cast<float>(capacity) : 0.f;
+}
+
+// Track to continue with when the current one ends, an empty path clears it
+void AudioStream::queue(const std::string &path) {
+  // Whether the track can be joined is decided under the lock, opening and prerolling read the
+  // disk and happen outside it, so neither the decode thread nor position() waits for them
+  auto joinable = [this](const std::unique_ptr<Decoder> &decoder) {
+    return !decoder || !current || (decoder->rate == current->rate && decoder->channels == current->channels);
+  };
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spliced && automatic) {
+      return; // the caller still thinks the track before it is playing, what follows is decided after advanced()
+    }
+  }
+  std::unique_ptr<Decoder> decoder = path.empty() ? nullptr : openDecoder(path);
+  size_t block = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spliced && automatic) {
+      return;
+    }
+    if (!joinable(decoder)) {
+      decoder.reset(); // SFML cannot change the format of a playing stream
+    }
+    block = buffer.size();
+  }
+  if (decoder) {
+    decoder->preroll(block);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spliced && automatic) {
+      return; // the current track ended and was spliced meanwhile
+    }
+    next = joinable(decoder) ? std::move(decoder) : nullptr;
+  }
+  wake.notify_one(); // the current track may already be decoded to its end
+}
+
+// Stream frame being heard, the silence played on underruns took time but no samples
+uint64_t AudioStream::heardFrame() {
+  uint64_t played = static_cast<uint64_t>(std::max<sf::Int64>(0, getPlayingOffset().asMicroseconds())) * current->rate / 1000000;
+  uint64_t gaps = silence.load(std::memory_order_relaxed);
+  return (played > gaps) ? played - gaps : 0;
+}
+
+// The spliced track is the one heard once playback passes its first sample
+void AudioStream::settle() {
+  if (!spliced || !current) {
+    return;
+  }
+  if (heardFrame() >= spliceAt) {
+    trackStart = spliceAt;
+    spliced = false;
+    advance = automatic;
+    if (automatic) {
+      advancedPath = current->source;
+    }
+    if (!fading) {
+      previous.reset(); // not read by the decode thread unless fading
+    }
+  }
+}
+
+// True once after the queued track became audible, path is then the file being heard
+bool AudioStream::advanced(std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  settle();
+  if (!advance) {
+    return false;
+  }
+  advance = false;
+  path = advancedPath;
+  return true;
+}
+
+// Seconds into the track being heard
+float AudioStream::position() {
+  std::lock_guard<std::mutex> lock(mutex);
+  settle();
+  if (!current) {
+    return 0.f;
+  }
+  uint64_t heard = heardFrame();
+  return (heard > trackStart) ? static_cast<float>(static_cast<double>(heard - trackStart) / current->rate) : 0.f;
+}
+
+float AudioStream::duration() {
+  std::lock_guard<std::mutex> lock(mutex);
+  settle();
+  Decoder *heard = spliced ? previous.get() : current.get();
+  return (heard && heard->rate > 0) ? static_cast<float>(static_cast<double>(heard->frames) / heard->rate) : 0.f;
+}
+
+void AudioStream::seek(float seconds) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    seeking = true;
+  }
+  setPlayingOffset(sf::seconds(seconds)); // stops the stream, calls onSeek() and restarts it
+}
+
+// Fade from the current track into path from where playback is now
+bool AudioStream::fadeTo(const std::string &path) {
+  if (crossfade <= 0.f || getStatus() != sf::SoundSource::Playing) {
+    return false;
+  }
+  std::unique_ptr<Decoder> decoder = openDecoder(path);
+  float at = position();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!decoder || !current || decoder->rate != current->rate || decoder->channels != current->channels || at <= 0.f) {
+      return false;
+    }
+    pendingFade = std::move(decoder);
+    fadeOffset = sf::seconds(at);
+  }
+  // The ring holds seconds of the current track that nobody has heard yet, so rather than
+  // fading in after them the stream restarts from what is heard now and fades from there
+  setPlayingOffset(fadeOffset);
+  return true;
+}
+
+void AudioStream::setCrossfade(float seconds, FadeCurve fadeCurve) {
+  std::lock_guard<std::mutex> lock(mutex);
+  crossfade = std::clamp(seconds, 0.f, 12.f);
+  curve = fadeCurve;
+}
+
+// Move the queued track in and fade the current one out under it, from stream frame at
+void AudioStream::startFade(uint64_t at, bool fromQueue) {
+  previous = std::move(current);
+  current = std::move(next);
+  spliceAt = at;
+  spliced = true;
+  automatic = fromQueue;
+  fading = true;
+  fadeAt = 0;
+  fadeLength = static_cast<uint64_t>(crossfade * static_cast<float>(current->rate));
+  if (previous->frames > previous->position) {
+    fadeLength = std::min(fadeLength, previous->frames - previous->position);
+  }
+}
+
+// Mix the next stretch of the fade into buffer at offset, returns the samples written
+size_t AudioStream::fadeInto(size_t offset, std::unique_lock<std::mutex> *lock) {
+  unsigned int channels = current->channels;
+  size_t count = static_cast<size_t>(std::min<uint64_t>(buffer.size() - offset, (fadeLength - fadeAt) * channels));
+  size_t got = readFrom(*previous, fadeOut.data(), count, lock);
+  std::fill(fadeOut.begin() + static_cast<std::ptrdiff_t>(got), fadeOut.begin() + static_cast<std::ptrdiff_t>(count), 0);
+  got = readFrom(*current, fadeIn.data(), count, lock);
+  std::fill(fadeIn.begin() + static_cast<std::ptrdiff_t>(got), fadeIn.begin() + static_cast<std::ptrdiff_t>(count), 0);
+  // The curve is evaluated every 256 frames and the gains ramp linearly in between
+  const size_t segment = 256 * channels;
+  for (size_t done = 0; done < count; done += segment) {
+    size_t n = std::min(segment, count - done);
+    float x0 = static_cast<float>(fadeAt + done / channels) / static_cast<float>(fadeLength);
+    float x1 = static_cast<float>(fadeAt + (done + n) / channels) / static_cast<float>(fadeLength);
+    float out0, in0, out1, in1;
+    fadeGains(curve, x0, out0, in0);
+    fadeGains(curve, std::min(x1, 1.f), out1, in1);
+    mixFade(fadeOut.data() + done, fadeIn.data() + done, buffer.data() + offset + done, n, out0, (out1 - out0) / static_cast<float>(n), in0, (in1 - in0) / static_cast<float>(n));
+  }
+  fadeAt += count / channels;
+  if (fadeAt >= fadeLength) {
+    fading = false;
+    if (!spliced) {
+      previous.reset();
+    }
+  }
+  return count;
+}
+
+// Decode thread: keeps the ring filled, one block at a time
+void AudioStream::produce() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!quit) {
+    bool drained = ended.load(std::memory_order_relaxed) && (!next || spliced);
+    if (!current || buffer.empty() || drained || ring.capacity() - ring.size() < buffer.size() || waiters > 0) {
+      // Woken early for new tracks and seeks, otherwise often enough to stay ahead of playback
+      wake.wait_for(lock, std::chrono::milliseconds(std::max(5, bufferMs / 4)));
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    size_t filled = decodeBlock(&lock);
+    ring.push(buffer.data(), filled);
+    ended.store(filled < buffer.size(), std::memory_order_release); // after the push, see onGetData()
+    stats.decode.record(std::chrono::steady_clock::now() - start);
+  }
+}
+
+// Decode the next block of the stream into buffer, splicing and fading between tracks, returns
+// the samples written, fewer than a block only at the end of the last track. The decode thread
+// passes its lock, which is let go while a decoder reads.
+size_t AudioStream::decodeBlock(std::unique_lock<std::mutex> *lock) {
+  unsigned int channels = current->channels;
+  size_t filled = 0;
+  while (filled < buffer.size()) {
+    if (fading) {
+      filled += fadeInto(filled, lock);
+      continue;
+    }
+    size_t want = buffer.size() - filled;
+    // Crossfade: the queued track comes in crossfade seconds before the end of this one
+    uint64_t fadeFrames = static_cast<uint64_t>(crossfade * static_cast<float>(current->rate));
+    if (next && !spliced && fadeFrames > 0 && current->frames > 2 * fadeFrames) {
+      uint64_t fadeStart = current->frames - fadeFrames;
+      if (current->position >= fadeStart) {
+        startFade(decoded + filled / channels, true);
+        continue;
+      }
+      want = static_cast<size_t>(std::min<uint64_t>(want, (fadeStart - current->position) * channels));
+    }
+    size_t got = readFrom(*current, buffer.data() + filled, want, lock);
+    filled += got;
+    if (got < want) {
+      // Gapless: the queued track starts on the sample after the last one of this track
+      if (!next || spliced) {
+        break;
+      }
+      spliceAt = decoded + filled / channels;
+      spliced = true;
+      automatic = true;
+      previous = std::move(current);
+      current = std::move(next);
+    }
+  }
+  decoded += filled / channels;
+  return filled;
+}
+
+// Read with the mutex let go when lock is given, so position() and duration() never wait for
+// the disk. Whoever replaces, seeks or frees decoders waits for the read in waitIdle().
+size_t AudioStream::readFrom(Decoder &decoder, int16_t *samples, size_t count, std::unique_lock<std::mutex> *lock) {
+  if (!lock) {
+    return decoder.read(samples, count);
+  }
+  reading = true;
+  lock->unlock();
+  size_t got = decoder.read(samples, count);
+  lock->lock();
+  reading = false;
+  idle.notify_all();
+  return got;
+}
+
+void AudioStream::waitIdle(std::unique_lock<std::mutex> &lock) {
+  waiters++;
+  idle.wait(lock, [this]() { return !reading; });
+  waiters--;
+}
+
+// Start the ring over with the first blocks from the current position, so SFML has something to
+// play the moment it starts; needs the streaming thread stopped and the mutex held
+void AudioStream::refill() {
+  ring.reset();
+  ended.store(false, std::memory_order_relaxed);
+  silence.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < 3 && current && !quit; i++) { // SFML queues three chunks before it plays
+    size_t filled = decodeBlock(nullptr);
+    ring.push(buffer.data(), filled);
+    if (filled < buffer.size()) {
+      ended.store(true, std::memory_order_relaxed);
+      break;
+    }
+  }
+}
+
+// Runs on SFML's streaming thread, copies out of the ring and nothing else
+bool AudioStream::onGetData(Chunk &data) {
+  if (output.empty()) {
+    return false;
+  }
+  bool end = ended.load(std::memory_order_acquire); // everything decoded before it is in the ring
+  size_t got = ring.pop(output.data(), output.size());
+  if (got < output.size() && !end) {
+    underrunCount.fetch_add(1, std::memory_order_relaxed);
+    if (got == 0) {
+      // Nothing decoded yet: a little silence keeps the stream going, an empty chunk would end it
+      got = std::min<size_t>(output.size(), static_cast<size_t>(getSampleRate() / 100 * getChannelCount()));
+      std::fill_n(output.begin(), got, 0);
+      silence.fetch_add(got / getChannelCount(), std::memory_order_relaxed);
+    }
+  }
+  data.samples = output.data();
+  data.sampleCount = got;
+  return !end || got == output.size();
+}
+
+// Runs with the streaming thread stopped, also on stop() with offset zero
+void AudioStream::onSeek(sf::Time offset) {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (pendingFade && offset != fadeOffset) {
+      return; // the stop() inside setPlayingOffset(), the fade starts on the seek after it
+    }
+    if (seeking && offset == sf::Time::Zero) {
+      // The same for seek(): rewinding and refilling here would only be thrown away by the
+      // seek to the target right after, which comes with offset zero too when that is the target
+      seeking = false;
+      return;
+    }
+    seeking = false;
+    waitIdle(lock);
+    if (spliced && automatic) {
+      // The seek is meant for the track still being heard, queue the spliced one again
+      next = std::move(current);
+      next->seek(0);
+      current = std::move(previous);
+    }
+    else if (spliced || fading) {
+      previous.reset(); // fadeTo() already made the new track the one to seek in
+    }
+    spliced = fading = false;
+    if (!current) {
+      return;
     }
-  } catch (const std::exception &e) {
-    std::cerr << "Error reading directory: " << e.what() << "\n";
+    uint64_t frame = static_cast<uint64_t>(std::max<sf::Int64>(0, offset.asMicroseconds())) * current->rate / 1000000;
+    current->seek(frame);
+    decoded = frame;
+    trackStart = 0;
+    if (pendingFade) {
+      next = std::move(pendingFade);
+      startFade(decoded, false);
+      advance = false; // the caller picked the track itself
+    }
+    refill();
   }
-  return files;
+  wake.notify_one();
 }
 
-// List m3u online radio files in directory and reads the metadata
-std::vector<Track> listM3uFiles(const std::string &path) {
-  std::vector<Track> files;
-  try {
-    for (const auto &entry : std::filesystem::directory_iterator(path)) {
-      if (entry.is_regular_file()) {
-        std::string ext = entry.path().extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        if (ext == ".m3u") {
-          files.push_back(readM3uMetadata(entry.path()));
-          //files.push_back({entry.path().string(), entry.path().filename().string()});
-        }
-      }
+// Vector types for mixFade. Samples are widened and narrowed eight at a time and the float
+// math runs four at a time, wider float vectors get their clamps split into scalar code
+// without AVX.
+typedef int16_t SampleLanes __attribute__((vector_size(16)));
+typedef int32_t WideSamples __attribute__((vector_size(32)));
+typedef int32_t WideLanes __attribute__((vector_size(16)));
+typedef float FadeLanes __attribute__((vector_size(16)));
+
+// out = a * gain a + b * gain b, both gains ramping linearly from sample to sample.
+// Written with vector types because -O2 does not vectorize the int16/float conversions on
+// its own; the two samples of a stereo frame get gains one step apart, far below anything audible.
+void mixFade(const int16_t *a, const int16_t *b, int16_t *out, size_t count, float gainA, float stepA, float gainB, float stepB) {
+  const FadeLanes lane = {0.f, 1.f, 2.f, 3.f};
+  const FadeLanes low = FadeLanes{} - 32768.f;
+  const FadeLanes high = FadeLanes{} + 32767.f;
+  FadeLanes ga = gainA + stepA * lane;
+  FadeLanes gb = gainB + stepB * lane;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    SampleLanes sa, sb;
+    std::memcpy(&sa, a + i, sizeof(sa));
+    std::memcpy(&sb, b + i, sizeof(sb));
+    WideSamples wa = __builtin_convertvector(sa, WideSamples);
+    WideSamples wb = __builtin_convertvector(sb, WideSamples);
+    WideLanes ha[2], hb[2], mixed[2];
+    std::memcpy(ha, &wa, sizeof(ha));
+    std::memcpy(hb, &wb, sizeof(hb));
+    for (int h = 0; h < 2; h++) {
+      FadeLanes v = __builtin_convertvector(ha[h], FadeLanes) * ga + __builtin_convertvector(hb[h], FadeLanes) * gb;
+      v = (v < low) ? low : v;
+      v = (v > high) ? high : v;
+      mixed[h] = __builtin_convertvector(v, WideLanes);
+      ga += stepA * 4.f;
+      gb += stepB * 4.f;
     }
-  } catch (const std::exception &e) {
-    std::cerr << "Error reading directory: " << e.what() << "\n";
+    WideSamples wide;
+    std::memcpy(&wide, mixed, sizeof(wide));
+    SampleLanes result = __builtin_convertvector(wide, SampleLanes);
+    std::memcpy(out + i, &result, sizeof(result));
+  }
+  for (; i < count; i++) {
+    float t = static_cast<float>(i);
+    float v = static_cast<float>(a[i]) * (gainA + stepA * t) + static_cast<float>(b[i]) * (gainB + stepB * t);
+    out[i] = static_cast<int16_t>(std::min(32767.f, std::max(-32768.f, v)));
   }
-  return files;
 }
 
-// List only the .m3u files and store their paths
-std::vector<std::string> listM3u(const std::string &path) {
-  std::vector<std::string> files;
-  try {
-    for (const auto &entry : std::filesystem::directory_iterator(path)) {
-      if (entry.is_regular_file()) {
-        std::string ext = entry.path().extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        if (ext == ".m3u") {
-          files.push_back(entry.path());
-          //files.push_back({entry.path().string(), entry.path().filename().string()});
-        }
-      }
-    }
-  } catch (const std::exception &e) {
-    std::cerr << "Error reading directory: " << e.what() << "\n";
+// Gains of the outgoing and incoming track x of the way through a fade
+void fadeGains(FadeCurve curve, float x, float &out, float &in) {
+  switch (curve) {
+    case FadeCurve::Linear:
+      in = x;
+      out = 1.f - x;
+      break;
+    case FadeCurve::EqualPower:
+      in = std::sin(x * 1.57079633f);
+      out = std::cos(x * 1.57079633f);
+      break;
+    case FadeCurve::SCurve:
+      in = x * x * (3.f - 2.f * x);
+      out = 1.f - in;
+      break;
   }
-  return files;
 }
 
 // Function to read metadata using TagLib
@@ -683,13 +4130,34 @@ Track readMetadata(const std::filesystem::path &filePath) {
     info.artist = tag->artist().isEmpty() ? "Unknown Artist" : tag->artist().to8Bit(true);
     info.album  = tag->album().isEmpty()  ? "Unknown Album" : tag->album().to8Bit(true);
   }
+  // Only note that lyrics are there, they are read again when the track plays
+  if (!f.isNull() && f.file()) {
+    auto *mpeg = dynamic_cast<TagLib::MPEG::File *>(f.file());
+    if (mpeg && mpeg->ID3v2Tag() && mpeg->ID3v2Tag()->frameListMap().contains("SYLT")) {
+      info.embeddedLyrics = info.embeddedSynced = true;
+    }
+    else {
+      TagLib::PropertyMap properties = f.file()->properties();
+      for (const char *key : {"LYRICS", "UNSYNCEDLYRICS"}) {
+        if (properties.contains(key) && !properties[key].isEmpty()) {
+          info.embeddedLyrics = true;
+          break;
+        }
+      }
+    }
+    if (f.audioProperties()) {
+      info.seconds = static_cast<float>(f.audioProperties()->lengthInMilliseconds()) / 1000.f;
+    }
+  }
   if (allOkay == 1U) {
     float duration = static_cast<float>(samples) / static_cast<float>(rate);
     info.duration = formatTime(duration);
+    info.seconds = duration;
     mpg123_close(mh);
     mpg123_delete(mh);
     mpg123_exit();
   }
+  info.titleLayout = layoutText(info.title);
   return info;
 }
 
@@ -701,6 +4169,7 @@ Track readM3uMetadata(const std::filesystem::path &filePath) {
   info.artist = "Unknown Artist";
   info.album = "Unknown Album";
   info.duration = "";
+  info.titleLayout = layoutText(info.title);
   return info;
 }
 
@@ -713,6 +4182,94 @@ std::string formatTime(float duration) {
   return std::string(buf);
 }
 
+// Decode one UTF-8 sequence at i and advance past it, malformed bytes decode as U+FFFD
+static char32_t decodeUtf8(const std::string &text, size_t &i) {
+  unsigned char c = static_cast<unsigned char>(text[i]);
+  int len = (c < 0x80) ? 1 : ((c >> 5) == 0x6) ? 2 : ((c >> 4) == 0xE) ? 3 : ((c >> 3) == 0x1E) ? 4 : 0;
+  if (len == 0 || i + static_cast<size_t>(len) > text.size()) {
+    i++;
+    return 0xFFFD;
+  }
+  char32_t cp = (len == 1) ? c : (c & (0x7F >> len));
+  for (int k = 1; k < len; k++) {
+    unsigned char cc = static_cast<unsigned char>(text[i + static_cast<size_t>(k)]);
+    if ((cc >> 6) != 0x2) {
+      i++;
+      return 0xFFFD;
+    }
+    cp = (cp << 6) | (cc & 0x3F);
+  }
+  i += static_cast<size_t>(len);
+  return cp;
+}
+
+// Split UTF-8 text into grapheme clusters and measure its terminal width.
+// Combining marks, variation selectors, emoji modifiers, ZWJ sequences and flag pairs join the previous cluster.
+TextLayout layoutText(const std::string &text) {
+  TextLayout layout;
+  if (std::all_of(text.begin(), text.end(), [](char c) { return c >= 0x20 && c < 0x7F; })) {
+    layout.width = static_cast<int>(text.size());
+    return layout;
+  }
+  bool joinNext = false;
+  bool openFlag = false; // a regional indicator waiting for its pair
+  uint32_t lastWidth = 0;
+  size_t i = 0;
+  while (i < text.size()) {
+    char32_t cp = decodeUtf8(text, i);
+    int w = wcwidth(static_cast<wchar_t>(cp));
+    if (w < 0) {
+      w = (cp < 0x20 || cp == 0x7F) ? 0 : 1;
+    }
+    bool regional = (cp >= 0x1F1E6 && cp <= 0x1F1FF);
+    bool modifier = (cp >= 0x1F3FB && cp <= 0x1F3FF);
+    if (!layout.clusters.empty() && (w == 0 || joinNext || modifier || (regional && openFlag))) {
+      auto &last = layout.clusters.back();
+      // An emoji presentation selector or a completed flag pair is drawn two columns wide
+      if ((cp == 0xFE0F || (regional && openFlag)) && lastWidth == 1) {
+        last.second++;
+        lastWidth = 2;
+      }
+      last.first = static_cast<uint32_t>(i);
+      openFlag = false;
+    }
+    else {
+      uint32_t before = layout.clusters.empty() ? 0 : layout.clusters.back().second;
+      lastWidth = static_cast<uint32_t>(w);
+      layout.clusters.emplace_back(static_cast<uint32_t>(i), before + lastWidth);
+      openFlag = regional;
+    }
+    joinNext = (cp == 0x200D);
+  }
+  layout.width = layout.clusters.empty() ? 0 : static_cast<int>(layout.clusters.back().second);
+  return layout;
+}
+
+// Stable ID of a track, FNV-1a of its path
+uint64_t trackId(const Track &track) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : track.path) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Longest prefix of text that fits in columns, cut between grapheme clusters
+std::string truncateToWidth(const std::string &text, const TextLayout &layout, int columns) {
+  if (columns <= 0) {
+    return "";
+  }
+  if (layout.width <= columns) {
+    return text;
+  }
+  if (layout.clusters.empty()) {
+    return text.substr(0, static_cast<size_t>(columns));
+  }
+  // clusters are sorted by width, find the last one that still fits
+  auto fits = std::upper_bound(layout.clusters.begin(), layout.clusters.end(), static_cast<uint32_t>(columns), [](uint32_t cols, const std::pair<uint32_t, uint32_t> &c) { return cols < c.second; });
+  return (fits == layout.clusters.begin()) ? "" : text.substr(0, std::prev(fits)->first);
+}
+
 // Draw progress bar with time
 void drawProgressBarWithTime(float elapsed, float total, int width, int y, int x) {
   float progress = (total > 0) ? elapsed / total : 0.f;
@@ -733,20 +4290,345 @@ void drawProgressBarWithTime(float elapsed, float total, int width, int y, int x
   printw(" %s", formatTime(total).c_str());
 }
 
-// Parse .lrc file
-std::vector<LyricLine> loadLyrics(const std::string &filename) {
+// Parse an LRC timestamp body, mm:ss, mm:ss.xx or mm:ss:xx, into seconds
+static bool parseLrcTime(std::string_view s, float &seconds) {
+  unsigned int minutes = 0;
+  unsigned int secs = 0;
+  const char *p = s.data();
+  const char *end = s.data() + s.size();
+  auto r = std::from_chars(p, end, minutes);
+  if (r.ec != std::errc() || r.ptr == end || *r.ptr != ':') {
+    return false;
+  }
+  p = r.ptr + 1;
+  r = std::from_chars(p, end, secs);
+  if (r.ec != std::errc() || r.ptr - p != 2) {
+    return false;
+  }
+  p = r.ptr;
+  float fraction = 0.f;
+  if (p != end) {
+    if (*p != '.' && *p != ':') {
+      return false;
+    }
+    float scale = 0.1f;
+    for (p++; p != end; p++, scale *= 0.1f) {
+      if (*p < '0' || *p > '9') {
+        return false;
+      }
+      fraction += static_cast<float>(*p - '0') * scale;
+    }
+  }
+  seconds = static_cast<float>(minutes * 60 + secs) + fraction;
+  return true;
+}
+
+// Parse LRC text held in memory into a timeline sorted by time.
+// Handles several timestamps per line, [offset:] and enhanced <mm:ss.xx> word timings.
+std::vector<LyricLine> parseLyrics(std::string_view text) {
   std::vector<LyricLine> lyrics;
-  std::ifstream file(filename);
-  if (!file) throw std::runtime_error("Cannot open lyrics file");
-  std::string line;
-  std::regex timeRegex(R"(\[(\d+):(\d+\.\d+)\](.*))");
-  std::smatch match;
-  while (std::getline(file, line)) {
-    if (std::regex_match(line, match, timeRegex)) {
+  lyrics.reserve(static_cast<size_t>(std::count(text.begin(), text.end(), '\n')) + 1);
+  std::vector<float> stamps;
+  float offset = 0.f; // seconds, positive shows lyrics earlier
+  while (!text.empty()) {
+    size_t eol = text.find('\n');
+    std::string_view line = text.substr(0, eol);
+    text.remove_prefix((eol == std::string_view::npos) ? text.size() : eol + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    // Leading [..] tags: timestamps, or one metadata tag such as [ar:] or [offset:]
+    stamps.clear();
+    while (!line.empty() && line.front() == '[') {
+      size_t close = line.find(']');
+      if (close == std::string_view::npos) {
+        break;
+      }
+      std::string_view tag = line.substr(1, close - 1);
+      float t;
+      if (parseLrcTime(tag, t)) {
+        stamps.push_back(t);
+        line.remove_prefix(close + 1);
+        continue;
+      }
+      if (stamps.empty() && tag.substr(0, 7) == "offset:") {
+        std::string_view value = tag.substr(7);
+        if (!value.empty() && value.front() == '+') {
+          value.remove_prefix(1);
+        }
+        int ms = 0;
+        if (std::from_chars(value.data(), value.data() + value.size(), ms).ec == std::errc()) {
+          offset = static_cast<float>(ms) / 1000.f;
+        }
+      }
+      break;
+    }
+    if (stamps.empty()) {
+      continue;
+    }
+    // Strip <mm:ss.xx> word tags out of the text, remembering where each word starts
+    LyricLine parsed{stamps[0], std::string(), TextLayout(), {}};
+    parsed.text.reserve(line.size());
+    size_t pos = 0;
+    while (pos < line.size()) {
+      size_t open = line.find('<', pos);
+      size_t close = (open == std::string_view::npos) ? open : line.find('>', open);
+      float t;
+      if (close == std::string_view::npos) {
+        parsed.text.append(line.substr(pos));
+        break;
+      }
+      parsed.text.append(line.substr(pos, open - pos));
+      if (parseLrcTime(line.substr(open + 1, close - open - 1), t)) {
+        parsed.words.push_back({t, static_cast<uint32_t>(parsed.text.size())});
+      }
+      else {
+        parsed.text.append(line.substr(open, close - open + 1));
+      }
+      pos = close + 1;
+    }
+    parsed.layout = layoutText(parsed.text);
+    // Repeated lines (several timestamps) share the text, word times move with the line
+    for (size_t k = 1; k < stamps.size(); k++) {
+      LyricLine copy = parsed;
+      copy.time = stamps[k];
+      for (auto &word : copy.words) {
+        word.time += stamps[k] - stamps[0];
+      }
+      lyrics.push_back(std::move(copy));
+    }
+    lyrics.push_back(std::move(parsed));
+  }
+  if (offset != 0.f) {
+    for (auto &line : lyrics) {
+      line.time = std::max(0.f, line.time - offset);
+      for (auto &word : line.words) {
+        word.time = std::max(0.f, word.time - offset);
+      }
+    }
+  }
+  std::stable_sort(lyrics.begin(), lyrics.end(), [](const LyricLine &a, const LyricLine &b) { return a.time < b.time; });
+  return lyrics;
+}
+
+// Time both LRC parsers on a file, or on a synthetic song when path is empty
+int runLrcBenchmark(const std::string &path) {
+  std::string lrc;
+  if (!path.empty()) {
+    std::ifstream file(path);
+    if (!file) {
+      std::cerr << "Cannot open " << path << "\n";
+      return EXIT_FAILURE;
+    }
+    std::stringstream buf;
+    buf << file.rdbuf();
+    lrc = buf.str();
+  }
+  else {
+    lrc = "[ar:Some Artist]\n[ti:Some Title]\n[length:04:00]\n";
+    for (unsigned int i = 0; i < 80; i++) {
+      char stamp[16];
+      snprintf(stamp, sizeof(stamp), "[%02u:%02u.%02u]", i * 3 / 60, i * 3 % 60, i % 100);
+      lrc += stamp + std::string("This is lyric line number ") + std::to_string(i) + " of the song\n";
+    }
+  }
+  const int rounds = 2000;
+  const struct { const char *name; std::vector<LyricLine> (*parse)(std::string_view); } parsers[] = {
+    {"regex", parseLyricsRegex}, {"lrc", parseLyrics},
+  };
+  double nsPerLine[2] = {0.0, 0.0};
+  std::cout << "input: " << (path.empty() ? "synthetic" : path) << ", " << lrc.size() << " bytes, " << rounds << " rounds\n";
+  for (int p = 0; p < 2; p++) {
+    size_t lines = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      lines += parsers[p].parse(lrc).size();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    nsPerLine[p] = (lines > 0) ? ns / static_cast<double>(lines) : 0.0;
+    std::cout << std::left << std::setw(8) << parsers[p].name << std::right << std::setw(8) << lines / static_cast<size_t>(rounds) << " lines " << std::fixed << std::setprecision(1) << std::setw(10) << ns / static_cast<double>(rounds) / 1000.0 << " us/parse " << std::setw(8) << nsPerLine[p] << " ns/line\n";
+  }
+  if (nsPerLine[1] > 0.0) {
+    std::cout << "speedup: " << std::setprecision(1) << nsPerLine[0] / nsPerLine[1] << "x\n";
+  }
+  // The same lyrics wrapped in an lrclib response, read through a json DOM and the streaming reader
+  std::string plain;
+  for (auto &line : parseLyrics(lrc)) {
+    plain += line.text + "\n";
+  }
+  json fake = {{"id", 1}, {"trackName", "Some Title"}, {"artistName", "Some Artist"}, {"albumName", "Some Album"}, {"duration", 240.0}, {"instrumental", false}, {"plainLyrics", plain}, {"syncedLyrics", lrc}};
+  std::string body = fake.dump();
+  double usPerResponse[2] = {0.0, 0.0};
+  size_t bytes = 0;
+  for (int p = 0; p < 2; p++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      if (p == 0) {
+        json data = json::parse(body);
+        bytes += data["syncedLyrics"].get_ref<const std::string &>().size();
+      }
+      else {
+        LrclibLyrics fields;
+        parseLrclibResponse(body, fields);
+        bytes += fields.synced.size();
+      }
+    }
+    usPerResponse[p] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+    std::cout << std::left << std::setw(8) << (p == 0 ? "dom" : "stream") << std::right << std::setw(8) << body.size() << " bytes " << std::setw(8) << usPerResponse[p] << " us/response\n";
+  }
+  if (usPerResponse[1] > 0.0 && bytes > 0) {
+    std::cout << "speedup: " << usPerResponse[0] / usPerResponse[1] << "x\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+// Lyrics search benchmark: songs of 60 lines over a Zipf distributed vocabulary, indexed and then
+// queried with phrases taken from them, against scanning every song's text for the phrase
+int runSearchBenchmark(int songCount) {
+  std::mt19937 gen(42);
+  const char *syllables[] = {"la", "mo", "ri", "ka", "ne", "so", "tu", "vi", "da", "pe", "lo", "mi", "ra", "ze", "no", "fa"};
+  std::vector<std::string> vocabulary;
+  std::vector<double> weights;
+  for (int i = 0; i < 6000; i++) {
+    std::string word;
+    for (int n = i; word.empty() || n > 0; n /= 16) {
+      word += syllables[n % 16];
+    }
+    vocabulary.push_back(word);
+    weights.push_back(1.0 / (i + 1));
+  }
+  std::discrete_distribution<int> pick(weights.begin(), weights.end());
+  std::vector<std::string> texts; // lowercase, for the scan
+  std::vector<std::string> phrases;
+  double indexMs = 0.0;
+  size_t lines = 0;
+  for (int song = 0; song < songCount; song++) {
+    std::vector<LyricLine> lyrics;
+    std::string text;
+    for (int l = 0; l < 60; l++) {
+      std::string line;
+      for (int w = 0; w < 6; w++) {
+        line += (w > 0 ? " " : "") + vocabulary[static_cast<size_t>(pick(gen))];
+      }
+      text += line + "\n";
+      lyrics.push_back({static_cast<float>(l) * 3.f, line, {}, {}});
+      if (gen() % 4000 == 0) {
+        phrases.push_back(line.substr(0, line.find(' ', line.find(' ') + 1))); // two words
+        phrases.push_back(line);
+      }
+    }
+    lines += lyrics.size();
+    auto start = std::chrono::steady_clock::now();
+    lyricsIndex.add(static_cast<uint64_t>(song) + 1, lyrics);
+    indexMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    texts.push_back(std::move(text));
+  }
+  std::cout << "songs: " << songCount << " lines: " << lines << " indexed in " << std::fixed << std::setprecision(1) << indexMs << " ms, " << lyricsIndex.bytes() / 1024 << " KiB\n";
+  size_t textBytes = 0;
+  for (auto &text : texts) {
+    textBytes += text.size();
+  }
+  std::cout << "lyrics text: " << textBytes / 1024 << " KiB\n";
+  // Short prefixes as typed, two word phrases and whole lines
+  const struct { const char *name; int every; } kinds[] = {{"prefix", 0}, {"2 words", 0}, {"line", 1}};
+  std::cout << std::left << std::setw(10) << "query" << std::right << std::setw(10) << "count" << std::setw(10) << "hits" << std::setw(12) << "index p50" << std::setw(10) << "p99" << std::setw(12) << "scan p50" << std::setw(10) << "hits" << "\n";
+  for (int k = 0; k < 3; k++) {
+    Histogram indexed, scanned;
+    size_t hits = 0;
+    size_t scanHits = 0;
+    int count = 0;
+    for (size_t i = static_cast<size_t>(kinds[k].every); i < phrases.size(); i += 2) {
+      std::string query = (k == 0) ? phrases[i].substr(0, 3) : phrases[i];
+      auto start = std::chrono::steady_clock::now();
+      hits += lyricsIndex.search(query, 500).size();
+      indexed.record(std::chrono::steady_clock::now() - start);
+      start = std::chrono::steady_clock::now();
+      size_t found = 0;
+      for (auto &text : texts) {
+        found += (text.find(query) != std::string::npos) ? 1 : 0;
+      }
+      scanned.record(std::chrono::steady_clock::now() - start);
+      scanHits += found;
+      count++;
+    }
+    std::cout << std::left << std::setw(10) << kinds[k].name << std::right << std::setw(10) << count << std::setw(10) << (count > 0 ? hits / static_cast<size_t>(count) : 0) << std::setprecision(3) << std::setw(12) << indexed.percentile(0.50) << std::setw(10) << indexed.percentile(0.99) << std::setw(12) << scanned.percentile(0.50) << std::setw(10) << (count > 0 ? scanHits / static_cast<size_t>(count) : 0) << "\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+// Crossfade benchmark: fades of seconds between two 44.1 kHz stereo noise tracks, mixed in
+// 100 ms blocks the way AudioStream does it, against the same mix one sample at a time
+int runMixBenchmark(int seconds) {
+  const unsigned int rate = 44100;
+  const unsigned int channels = 2;
+  const size_t frames = static_cast<size_t>(seconds) * rate;
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> noise(-20000, 20000);
+  std::vector<int16_t> a(frames * channels), b(frames * channels), out(frames * channels);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = static_cast<int16_t>(noise(gen));
+    b[i] = static_cast<int16_t>(noise(gen));
+  }
+  // Scalar reference, what the mix costs without the vector kernel
+  auto mixScalar = [](const int16_t *x, const int16_t *y, int16_t *o, size_t count, float gainA, float stepA, float gainB, float stepB) {
+    for (size_t i = 0; i < count; i++) {
+      float v = static_cast<float>(x[i]) * gainA + static_cast<float>(y[i]) * gainB;
+      o[i] = static_cast<int16_t>(std::min(32767.f, std::max(-32768.f, v)));
+      gainA += stepA;
+      gainB += stepB;
+    }
+  };
+  const char *names[] = {"linear", "equal-power", "s-curve"};
+  const FadeCurve curves[] = {FadeCurve::Linear, FadeCurve::EqualPower, FadeCurve::SCurve};
+  const size_t block = rate / 10 * channels;
+  const size_t segment = 256 * channels;
+  std::cout << "fade: " << seconds << " s, " << rate << " Hz stereo\n";
+  std::cout << std::left << std::setw(14) << "curve" << std::right << std::setw(12) << "ns/frame" << std::setw(10) << "core" << std::setw(18) << "scalar ns/frame" << std::setw(10) << "core" << "\n";
+  for (int c = 0; c < 3; c++) {
+    double best[2] = {1e30, 1e30};
+    for (int pass = 0; pass < 2; pass++) {
+      for (int round = 0; round < 5; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t at = 0; at < a.size(); at += block) {
+          size_t count = std::min(block, a.size() - at);
+          for (size_t done = 0; done < count; done += segment) {
+            size_t n = std::min(segment, count - done);
+            float x0 = static_cast<float>((at + done) / channels) / static_cast<float>(frames);
+            float x1 = static_cast<float>((at + done + n) / channels) / static_cast<float>(frames);
+            float out0, in0, out1, in1;
+            fadeGains(curves[c], x0, out0, in0);
+            fadeGains(curves[c], x1, out1, in1);
+            (pass == 0 ? mixFade : +mixScalar)(a.data() + at + done, b.data() + at + done, out.data() + at + done, n, out0, (out1 - out0) / static_cast<float>(n), in0, (in1 - in0) / static_cast<float>(n));
+          }
+        }
+        best[pass] = std::min(best[pass], std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / static_cast<double>(frames));
+      }
+    }
+    // A second of audio is rate frames, a core has 1e9 ns of it
+    std::cout << std::left << std::setw(14) << names[c] << std::right << std::fixed << std::setprecision(2) << std::setw(12) << best[0] << std::setw(9) << std::setprecision(3) << best[0] * rate / 1e7 << "%" << std::setw(18) << std::setprecision(2) << best[1] << std::setw(9) << std::setprecision(3) << best[1] * rate / 1e7 << "%\n";
+  }
+  volatile int16_t sink = out[out.size() / 2]; // keep the mix from being optimized away
+  (void)sink;
+  return EXIT_SUCCESS;
+}
+
+// The std::regex LRC parser this replaced, kept for --bench-lrc
+std::vector<LyricLine> parseLyricsRegex(std::string_view text) {
+  std::vector<LyricLine> lyrics;
+  static const std::regex timeRegex(R"(\[(\d+):(\d+\.\d+)\](.*))");
+  std::cmatch match;
+  while (!text.empty()) {
+    size_t eol = text.find('\n');
+    std::string_view line = text.substr(0, eol);
+    text.remove_prefix((eol == std::string_view::npos) ? text.size() : eol + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (std::regex_match(line.data(), line.data() + line.size(), match, timeRegex)) {
       float minutes = std::stof(match[1]);
       float seconds = std::stof(match[2]);
-      std::string text = match[3];
-      lyrics.push_back({minutes * 60 + seconds, text});
+      std::string lyric = match[3];
+      lyrics.push_back({minutes * 60 + seconds, lyric, layoutText(lyric), {}});
     }
   }
   return lyrics;
@@ -760,63 +4642,333 @@ static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* use
     return totalSize;
 }
 
+// Progress callback that aborts transfers once the player quits
+static int AbortCallback(void*, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+  return running ? 0 : 1;
+}
+
 // fetch the and save the lyrics
-bool fetchLyricsToFile(const std::string &url, const std::string &outputFile) {
-    CURL* curl;
-    CURLcode res;
-    std::string response;
-    long int http_code = 0;
-
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl = curl_easy_init();
-
-    if (!curl) {
-      std::cerr << "Failed to initialize cURL.\n";
-      curl_global_cleanup();
-      return false;
+FetchStatus fetchLyrics(const std::string &url, std::string &response) {
+  return httpClient.get(url, response);
+}
+
+// Called once before any thread uses curl, curl_global_init is not thread safe
+bool HttpClient::init() {
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    std::cerr << "Failed to initialize cURL.\n";
+    return false;
+  }
+  share = curl_share_init();
+  if (share) {
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  }
+  return true;
+}
+
+// Called once after the last request finished
+void HttpClient::cleanup() {
+  std::lock_guard<std::mutex> lock(poolMutex);
+  for (CURL *curl : pool) {
+    curl_easy_cleanup(curl);
+  }
+  pool.clear();
+  if (share) {
+    curl_share_cleanup(share);
+    share = nullptr;
+  }
+  curl_global_cleanup();
+}
+
+FetchStatus HttpClient::get(const std::string &url, std::string &response) {
+  CURL *curl = acquire();
+  if (!curl) {
+    std::cerr << "Failed to initialize cURL.\n";
+    return FetchStatus::Error;
+  }
+  requests++;
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+  CURLcode res = curl_easy_perform(curl);
+  long int http_code = 0;
+  if (res == CURLE_OK) {
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  }
+  else {
+    std::cerr << "cURL error: " << curl_easy_strerror(res) << "\n";
+  }
+  release(curl);
+  if (res != CURLE_OK) {
+    return FetchStatus::Error;
+  }
+  if (http_code == 404) {
+    return FetchStatus::NotFound;
+  }
+  return (http_code < 400) ? FetchStatus::Ok : FetchStatus::Error;
+}
+
+// An idle handle from the pool, or a new one with the options every request uses
+CURL *HttpClient::acquire() {
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool.empty()) {
+      CURL *curl = pool.back();
+      pool.pop_back();
+      return curl;
     }
+  }
+  CURL *curl = curl_easy_init();
+  if (!curl) {
+    return nullptr;
+  }
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla 5.0");
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // Runs off the main thread
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, AbortCallback);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L); // lrclib connections stay open between songs
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 60L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 30L);
+  curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+  if (share) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+  }
+  return curl;
+}
+
+void HttpClient::release(CURL *curl) {
+  std::lock_guard<std::mutex> lock(poolMutex);
+  pool.push_back(curl);
+}
 
-    // Set cURL options
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla 5.0");
+// Percent encode text for a query string, & # ? + and non-ASCII included
+std::string HttpClient::escape(std::string_view text) {
+  CURL *curl = acquire();
+  if (!curl) {
+    return "";
+  }
+  char *escaped = curl_easy_escape(curl, text.data(), static_cast<int>(text.size()));
+  std::string result = escaped ? escaped : "";
+  curl_free(escaped);
+  release(curl);
+  return result;
+}
+
+void HttpClient::lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userp) {
+  static_cast<HttpClient *>(userp)->shareLocks[data].lock();
+}
 
-    // Perform the request
-    res = curl_easy_perform(curl);
+void HttpClient::unlockShare(CURL *, curl_lock_data data, void *userp) {
+  static_cast<HttpClient *>(userp)->shareLocks[data].unlock();
+}
+
+// Minimal JSON reading for lrclib responses: one pass over the text, string bodies are copied
+// in runs between escapes and values the player does not use are skipped without being stored.
+static void skipJsonSpace(std::string_view s, size_t &i) {
+  while (i < s.size() && (s[i] == ' ' || s[i] == '\n' || s[i] == '\r' || s[i] == '\t')) {
+    i++;
+  }
+}
 
-    if (res != CURLE_OK) {
-      std::cerr << "cURL error: " << curl_easy_strerror(res) << "\n";
-      curl_easy_cleanup(curl);
-      curl_global_cleanup();
+// Read the string starting at s[i] == '"', out may be null to only skip it
+static bool readJsonString(std::string_view s, size_t &i, std::string *out) {
+  i++;
+  while (i < s.size()) {
+    size_t stop = i;
+    while (stop < s.size() && s[stop] != '"' && s[stop] != '\\') {
+      stop++;
+    }
+    if (stop == s.size()) {
       return false;
     }
-
-    if (res == CURLE_OK) {
-      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-      if (http_code == 404) {
+    if (out) {
+      out->append(s.substr(i, stop - i));
+    }
+    i = stop + 1;
+    if (s[stop] == '"') {
+      return true;
+    }
+    if (i >= s.size()) {
+      return false;
+    }
+    char c = s[i++];
+    char32_t cp = 0;
+    switch (c) {
+      case '"': case '\\': case '/': cp = static_cast<char32_t>(c); break;
+      case 'b': cp = '\b'; break;
+      case 'f': cp = '\f'; break;
+      case 'n': cp = '\n'; break;
+      case 'r': cp = '\r'; break;
+      case 't': cp = '\t'; break;
+      case 'u': {
+        auto hex4 = [&](char32_t &v) {
+          if (i + 4 > s.size()) return false;
+          unsigned int value = 0;
+          if (std::from_chars(s.data() + i, s.data() + i + 4, value, 16).ptr != s.data() + i + 4) return false;
+          v = value;
+          i += 4;
+          return true;
+        };
+        if (!hex4(cp)) {
+          return false;
+        }
+        // A high surrogate must be followed by \u and a low one
+        if (cp >= 0xD800 && cp < 0xDC00) {
+          char32_t low = 0;
+          if (i + 2 > s.size() || s[i] != '\\' || s[i + 1] != 'u') return false;
+          i += 2;
+          if (!hex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+        break;
+      }
+      default:
         return false;
+    }
+    if (out) {
+      if (cp < 0x80) {
+        out->push_back(static_cast<char>(cp));
+      }
+      else if (cp < 0x800) {
+        out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      }
+      else if (cp < 0x10000) {
+        out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      }
+      else {
+        out->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
       }
     }
+  }
+  return false;
+}
 
-    // Save to .lrc file
-    std::ofstream outFile(outputFile, std::ios::out | std::ios::trunc);
-    if (!outFile) {
-      std::cerr << "Error opening file for writing: " << outputFile << "\n";
-      curl_easy_cleanup(curl);
-      curl_global_cleanup();
+// Skip any JSON value starting at s[i]
+static bool skipJsonValue(std::string_view s, size_t &i, int depth) {
+  if (i >= s.size() || depth > 64) {
+    return false;
+  }
+  char c = s[i];
+  if (c == '"') {
+    return readJsonString(s, i, nullptr);
+  }
+  if (c == '{' || c == '[') {
+    char close = (c == '{') ? '}' : ']';
+    i++;
+    skipJsonSpace(s, i);
+    if (i < s.size() && s[i] == close) {
+      i++;
+      return true;
+    }
+    while (i < s.size()) {
+      if (c == '{') {
+        if (s[i] != '"' || !readJsonString(s, i, nullptr)) return false;
+        skipJsonSpace(s, i);
+        if (i >= s.size() || s[i++] != ':') return false;
+        skipJsonSpace(s, i);
+      }
+      if (!skipJsonValue(s, i, depth + 1)) return false;
+      skipJsonSpace(s, i);
+      if (i < s.size() && s[i] == ',') {
+        i++;
+        skipJsonSpace(s, i);
+        continue;
+      }
+      if (i < s.size() && s[i] == close) {
+        i++;
+        return true;
+      }
       return false;
     }
-    outFile << response;
-    outFile.close();
+    return false;
+  }
+  for (std::string_view literal : {"true", "false", "null"}) {
+    if (s.substr(i, literal.size()) == literal) {
+      i += literal.size();
+      return true;
+    }
+  }
+  size_t start = i;
+  while (i < s.size() && (std::isdigit(static_cast<unsigned char>(s[i])) || s[i] == '-' || s[i] == '+' || s[i] == '.' || s[i] == 'e' || s[i] == 'E')) {
+    i++;
+  }
+  return i > start;
+}
 
-    //std::cout << "Lyrics saved to: " << outputFile << "\n";
+// Pull syncedLyrics, plainLyrics and duration out of an lrclib response without building a DOM
+bool parseLrclibResponse(std::string_view body, LrclibLyrics &lyrics) {
+  lyrics = LrclibLyrics();
+  size_t i = 0;
+  std::string key;
+  skipJsonSpace(body, i);
+  if (i >= body.size() || body[i++] != '{') {
+    return false;
+  }
+  skipJsonSpace(body, i);
+  if (i < body.size() && body[i] == '}') {
+    i++;
+  }
+  else {
+    while (true) {
+      key.clear();
+      if (i >= body.size() || body[i] != '"' || !readJsonString(body, i, &key)) return false;
+      skipJsonSpace(body, i);
+      if (i >= body.size() || body[i++] != ':') return false;
+      skipJsonSpace(body, i);
+      std::string *target = (key == "syncedLyrics") ? &lyrics.synced : (key == "plainLyrics") ? &lyrics.plain : nullptr;
+      if (target) {
+        target->clear(); // a repeated key replaces the earlier value
+      }
+      if (target && i < body.size() && body[i] == '"') {
+        if (!readJsonString(body, i, target)) return false;
+      }
+      else if (key == "duration" && i < body.size() && body[i] != 'n') {
+        size_t start = i;
+        if (!skipJsonValue(body, i, 1)) return false;
+        double seconds = 0.0;
+        std::from_chars(body.data() + start, body.data() + i, seconds);
+        lyrics.duration = static_cast<float>(seconds);
+      }
+      else if (!skipJsonValue(body, i, 1)) {
+        return false;
+      }
+      skipJsonSpace(body, i);
+      if (i < body.size() && body[i] == ',') {
+        i++;
+        skipJsonSpace(body, i);
+        continue;
+      }
+      if (i < body.size() && body[i] == '}') {
+        i++;
+        break;
+      }
+      return false;
+    }
+  }
+  skipJsonSpace(body, i);
+  return i == body.size();
+}
 
-    // Cleanup
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
-    return true;
+// Per-user cache directory, $XDG_CACHE_HOME/0verau or ~/.cache/0verau
+std::string cacheDir() {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  if (xdg && *xdg) {
+    return static_cast<std::string>(xdg) + "/0verau";
+  }
+  return (getenv("HOME") ? static_cast<std::string>(getenv("HOME")) : static_cast<std::string>(".")) + "/.cache/0verau";
 }
 
 // Convert string to key code
@@ -832,6 +4984,7 @@ std::unordered_map<std::string, int> loadKeyBindings(const std::string &configPa
     {"UP", 'i'}, {"DOWN", 'j'}, {"PLAY", 'o'}, {"SEEKLEFT", ','}, {"SEEKRIGHT", '.'}, {"NEXT_SONG", '&'}, {"PREVIOUS_SONG", '*'},
     {"PAUSE", 'p'}, {"QUIT", 'q'}, {"REPEAT", '@'}, {"SHOW_HIDE_ALBUM", '$'}, {"SHOW_HIDE_ONLINE_RADIO", '^'},
     {"SHUFFLE", '!'}, {"SEARCH", '/'}, {"VOLUMEUP", '+'}, {"VOLUMEDOWN", '-'}, {"SHOW_HIDE_ARTIST", '#'}, {"SHOW_HIDE_LYRICS", '%'},
+    {"SHOW_HIDE_STATS", '~'}, {"SEARCH_LYRICS", '?'},
   };
   std::ifstream file(configPath);
   if (!file.is_open()) { return keys; }
@@ -843,6 +4996,7 @@ std::unordered_map<std::string, int> loadKeyBindings(const std::string &configPa
     if (std::getline(iss, key, '=') && std::getline(iss, val)) {
       key.erase(remove_if(key.begin(), key.end(), ::isspace), key.end());
       val.erase(remove_if(val.begin(), val.end(), ::isspace), val.end());
+      if (isSetting(key)) continue; // Handled by loadSettings
       int code = keyFromString(val);
       if (code != -1) {
         keys[key] = code;
@@ -852,4 +5006,68 @@ std::unordered_map<std::string, int> loadKeyBindings(const std::string &configPa
     }
   }
   return keys;
-}
\ No newline at end of file
+}
+
+// Whether a config file entry is an option rather than a key binding
+bool isSetting(const std::string &key) {
+  return key == "LYRICS_FPS" || key == "LYRICS_CACHE_MB" || key == "LYRICS_PREFETCH" || key == "LYRICS_RATE" || key == "LYRICS_STORE_MB" || key == "SEEK_INDEX_MB" || key == "LYRICS_MISS_DAYS" || key == "LYRICS_ERROR_MINUTES" || key == "LRCLIB_URL" || key == "CROSSFADE_SECONDS" || key == "CROSSFADE_CURVE" || key == "AUDIO_BUFFER_MS" || key == "AUDIO_READAHEAD_MS";
+}
+
+// Load the options that are not key bindings from config file
+Settings loadSettings(const std::string &configPath) {
+  Settings result;
+  std::ifstream file(configPath);
+  if (!file.is_open()) { return result; }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue; // Skip comments
+    std::istringstream iss(line);
+    std::string key, val;
+    if (std::getline(iss, key, '=') && std::getline(iss, val)) {
+      key = trim(key);
+      val = trim(val);
+      if (key == "LYRICS_FPS") {
+        result.lyricsFps = std::clamp(std::atoi(val.c_str()), 30, 60);
+      }
+      else if (key == "LYRICS_CACHE_MB") {
+        result.lyricsCacheBytes = static_cast<size_t>(std::clamp(std::atoi(val.c_str()), 1, 1024)) << 20;
+      }
+      else if (key == "LYRICS_PREFETCH") {
+        result.lyricsPrefetch = std::clamp(std::atoi(val.c_str()), 0, 20);
+      }
+      else if (key == "LYRICS_RATE") {
+        result.lyricsRate = std::clamp(std::atoi(val.c_str()), 1, 600);
+      }
+      else if (key == "LYRICS_STORE_MB") {
+        result.lyricsStoreBytes = static_cast<size_t>(std::clamp(std::atoi(val.c_str()), 1, 4096)) << 20;
+      }
+      else if (key == "SEEK_INDEX_MB") {
+        result.seekIndexBytes = static_cast<size_t>(std::clamp(std::atoi(val.c_str()), 1, 1024)) << 20;
+      }
+      else if (key == "LYRICS_MISS_DAYS") {
+        result.lyricsMissDays = std::clamp(std::atoi(val.c_str()), 0, 365);
+      }
+      else if (key == "LYRICS_ERROR_MINUTES") {
+        result.lyricsErrorMinutes = std::clamp(std::atoi(val.c_str()), 0, 1440);
+      }
+      else if (key == "LRCLIB_URL" && !val.empty()) {
+        result.lrclibUrl = val.substr(0, val.find_last_not_of('/') + 1);
+      }
+      else if (key == "CROSSFADE_SECONDS") {
+        result.crossfade = std::clamp(static_cast<float>(std::atof(val.c_str())), 0.f, 12.f);
+      }
+      else if (key == "AUDIO_BUFFER_MS") {
+        result.audioBufferMs = std::clamp(std::atoi(val.c_str()), 20, 1000);
+      }
+      else if (key == "AUDIO_READAHEAD_MS") {
+        result.audioReadAheadMs = std::clamp(std::atoi(val.c_str()), 200, 10000);
+      }
+      else if (key == "CROSSFADE_CURVE") {
+        if (val == "linear") result.crossfadeCurve = FadeCurve::Linear;
+        else if (val == "equal-power") result.crossfadeCurve = FadeCurve::EqualPower;
+        else if (val == "s-curve") result.crossfadeCurve = FadeCurve::SCurve;
+      }
+    }
+  }
+  return result;
+}